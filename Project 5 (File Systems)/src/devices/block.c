@@ -3,7 +3,12 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -17,10 +22,33 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block *parent;               /* Device holding this one, if any. */
+    block_sector_t start;               /* First sector within PARENT. */
+    struct block_queue *queue;          /* Request queue, if any. */
+
+    struct block_stats stats;           /* I/O statistics. */
+    block_sector_t next_sector;         /* Sector after the last request. */
   };
 
+/* A queue of requests to the devices behind a single controller,
+   serviced in elevator order by a dispatcher thread. */
+struct block_queue
+  {
+    struct lock lock;                   /* Protects all members. */
+    struct condition pending_cond;      /* Signaled when PENDING grows. */
+    struct list pending;                /* Requests, oldest first. */
+    block_sector_t head;                /* Sector following the last
+                                           dispatched request. */
+  };
+
+/* Time allowed a request before it is dispatched ahead of the
+   elevator order.  Readers are usually waiting; writers rarely. */
+#define READ_DEADLINE (TIMER_FREQ / 20)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
+
+/* -iostat: Collect latency, locality and queue depth statistics. */
+bool block_detailed_stats;
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -28,6 +56,10 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *const buffers[], bool write);
+static void dispatcher (void *queue_);
+static void complete (struct block_request *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +145,20 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are within
+   BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  if (cnt > 0)
+    {
+      check_sector (block, sector);
+      check_sector (block, sector + cnt - 1);
+      if (sector + cnt - 1 < sector)
+        PANIC ("Sector range wraps on device %s", block_name (block));
+    }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +166,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_readv (block, sector, 1, &buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +177,246 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
+  block_writev (block, sector, 1, &buffer);
+}
+
+/* Wakes up the thread waiting for synchronous request R. */
+static void
+wake_waiter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Submits requests for the CNT sectors starting at SECTOR on
+   BLOCK and waits for all of them to complete.  The requests go
+   out together, so the elevator may merge or reorder them. */
+static void
+submit_and_wait (struct block *block, block_sector_t sector, size_t cnt,
+                 void *const buffers[], bool write)
+{
+  struct block_request r[8];
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  while (cnt > 0)
+    {
+      size_t n, i;
+
+      for (n = 0; n < sizeof r / sizeof *r && cnt > 0; n++)
+        {
+          size_t chunk = cnt < BLOCK_MULTIPLE_MAX ? cnt : BLOCK_MULTIPLE_MAX;
+
+          r[n].block = block;
+          r[n].sector = sector;
+          r[n].cnt = chunk;
+          r[n].buffers = buffers;
+          r[n].write = write;
+          r[n].done = wake_waiter;
+          r[n].aux = &done;
+          block_submit (&r[n]);
+
+          sector += chunk;
+          buffers += chunk;
+          cnt -= chunk;
+        }
+      for (i = 0; i < n; i++)
+        sema_down (&done);
+    }
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFERS[0] through BUFFERS[CNT - 1], each of which
+   must have room for BLOCK_SECTOR_SIZE bytes.  Drivers that can
+   transfer several sectors per command do so. */
+void
+block_readv (struct block *block, block_sector_t sector, size_t cnt,
+             void *const buffers[])
+{
+  check_sectors (block, sector, cnt);
+  submit_and_wait (block, sector, cnt, buffers, false);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFERS[0] through BUFFERS[CNT - 1], each of which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block
+   device has acknowledged receiving all of the data. */
+void
+block_writev (struct block *block, block_sector_t sector, size_t cnt,
+              const void *const buffers[])
+{
+  check_sectors (block, sector, cnt);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit_and_wait (block, sector, cnt, (void *const *) buffers, true);
+}
+
+/* Counts a request for the CNT sectors starting at SECTOR
+   against BLOCK. */
+static void
+account (struct block *block, block_sector_t sector, size_t cnt, bool write)
+{
+  struct block_stats *s = &block->stats;
+  enum intr_level old_level;
+
+  if (write)
+    s->write_cnt += cnt;
+  else
+    s->read_cnt += cnt;
+  if (!block_detailed_stats)
+    return;
+
+  old_level = intr_disable ();
+  if (sector == block->next_sector)
+    s->seq_cnt++;
+  else
+    s->random_cnt++;
+  block->next_sector = sector + cnt;
+  if (++s->depth > s->max_depth)
+    s->max_depth = s->depth;
+  intr_set_level (old_level);
+}
+
+/* Records the completion of R against each device it passed
+   through, then calls R's DONE function. */
+static void
+complete (struct block_request *r)
+{
+  if (block_detailed_stats)
+    {
+      uint64_t cycles = rdtsc () - r->start_tsc;
+      enum intr_level old_level;
+      struct block *b;
+      int bucket;
+
+      for (bucket = 0; bucket < BLOCK_LATENCY_BUCKETS - 1; bucket++)
+        if (cycles >> (bucket + 1) == 0)
+          break;
+
+      old_level = intr_disable ();
+      for (b = r->origin; b != NULL; b = b->parent)
+        {
+          b->stats.depth--;
+          b->stats.latency[bucket]++;
+        }
+      intr_set_level (old_level);
+    }
+  r->done (r);
+}
+
+/* Submits request R.  Requests to a device without a queue are
+   carried out immediately, in the caller's thread; otherwise R
+   joins its device's queue and R->DONE is later called from
+   the queue's dispatcher thread.  Either way, R->DONE may not
+   sleep on anything that waits for further block I/O. */
+void
+block_submit (struct block_request *r)
+{
+  struct block_queue *q;
+
+  ASSERT (r->cnt > 0 && r->cnt <= BLOCK_MULTIPLE_MAX);
+  check_sectors (r->block, r->sector, r->cnt);
+  ASSERT (!r->write || r->block->type != BLOCK_FOREIGN);
+
+  /* Count the request against each device it passes through,
+     down to the one that actually holds the data. */
+  r->origin = r->block;
+  if (block_detailed_stats)
+    r->start_tsc = rdtsc ();
+  for (;;)
+    {
+      account (r->block, r->sector, r->cnt, r->write);
+      if (r->block->parent == NULL)
+        break;
+      r->sector += r->block->start;
+      r->block = r->block->parent;
+    }
+
+  q = r->block->queue;
+  if (q == NULL)
+    {
+      transfer (r->block, r->sector, r->cnt, r->buffers, r->write);
+      complete (r);
+      return;
+    }
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  lock_acquire (&q->lock);
+  list_push_back (&q->pending, &r->elem);
+  cond_signal (&q->pending_cond, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Has BLOCK's driver transfer the CNT consecutive sectors,
+   at most BLOCK_MULTIPLE_MAX, starting at SECTOR. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *const buffers[], bool write)
+{
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->writev != NULL)
+        block->ops->writev (block->aux, sector, cnt,
+                            (const void *const *) buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i, buffers[i]);
+    }
+  else
+    {
+      if (block->ops->readv != NULL)
+        block->ops->readv (block->aux, sector, cnt, buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i, buffers[i]);
+    }
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  void *buffers[BLOCK_MULTIPLE_MAX];
+
+  while (cnt > 0)
+    {
+      size_t chunk = cnt < BLOCK_MULTIPLE_MAX ? cnt : BLOCK_MULTIPLE_MAX;
+      size_t i;
+
+      for (i = 0; i < chunk; i++)
+        buffers[i] = (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE;
+      block_readv (block, sector, chunk, buffers);
+
+      sector += chunk;
+      buffer = (uint8_t *) buffer + chunk * BLOCK_SECTOR_SIZE;
+      cnt -= chunk;
+    }
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  const void *buffers[BLOCK_MULTIPLE_MAX];
+
+  while (cnt > 0)
+    {
+      size_t chunk = cnt < BLOCK_MULTIPLE_MAX ? cnt : BLOCK_MULTIPLE_MAX;
+      size_t i;
+
+      for (i = 0; i < chunk; i++)
+        buffers[i] = (const uint8_t *) buffer + i * BLOCK_SECTOR_SIZE;
+      block_writev (block, sector, chunk, buffers);
+
+      sector += chunk;
+      buffer = (const uint8_t *) buffer + chunk * BLOCK_SECTOR_SIZE;
+      cnt -= chunk;
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +440,28 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Copies BLOCK's I/O statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/* Records that a pass writing back a cache of BLOCK wrote CNT
+   sectors and took TICKS timer ticks, e.g. for fsync() or the
+   buffer cache's flush daemon. */
+void
+block_account_flush (struct block *block, size_t cnt, int64_t ticks)
+{
+  enum intr_level old_level = intr_disable ();
+  block->stats.flush_cnt++;
+  block->stats.flush_write_cnt += cnt;
+  block->stats.flush_ticks += ticks;
+  intr_set_level (old_level);
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -169,12 +471,34 @@ block_print_stats (void)
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct block_stats s;
+      int j;
+
+      if (block == NULL)
+        continue;
+
+      block_get_stats (block, &s);
+      printf ("%s (%s): %llu reads, %llu writes\n",
+              block->name, block_type_name (block->type),
+              s.read_cnt, s.write_cnt);
+      if (s.flush_cnt != 0)
+        printf ("  %llu flushes wrote %llu sectors in %lld ms\n",
+                s.flush_cnt, s.flush_write_cnt,
+                s.flush_ticks * 1000 / TIMER_FREQ);
+      if (!block_detailed_stats)
+        continue;
+
+      printf ("  %llu bytes read, %llu bytes written\n",
+              s.read_cnt * BLOCK_SECTOR_SIZE, s.write_cnt * BLOCK_SECTOR_SIZE);
+      printf ("  %llu sequential, %llu random requests, "
+              "peak queue depth %u\n",
+              s.seq_cnt, s.random_cnt, s.max_depth);
+      printf ("  latency (TSC cycles):");
+      for (j = 0; j < BLOCK_LATENCY_BUCKETS; j++)
+        if (s.latency[j] != 0)
+          printf (" %s2^%d: %llu", j == BLOCK_LATENCY_BUCKETS - 1 ? ">=" : "",
+                  j, s.latency[j]);
+      printf ("\n");
     }
 }
 
@@ -198,8 +522,11 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  block->parent = NULL;
+  block->start = 0;
+  block->queue = NULL;
+  memset (&block->stats, 0, sizeof block->stats);
+  block->next_sector = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +538,176 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Declares that BLOCK's sectors are those of PARENT beginning
+   at sector START, as for a partition on a disk.  Requests to
+   BLOCK are then carried out as requests to PARENT, so that they
+   share PARENT's queue. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (block != parent);
+  check_sectors (parent, start, block->size);
+  block->parent = parent;
+  block->start = start;
+}
+
+/* Creates a request queue and starts a dispatcher thread, named
+   after NAME, to service it.  Panics on failure. */
+struct block_queue *
+block_queue_create (const char *name)
+{
+  struct block_queue *q = malloc (sizeof *q);
+  char thread_name[16];
+
+  if (q == NULL)
+    PANIC ("Failed to allocate memory for block request queue");
+  lock_init (&q->lock);
+  cond_init (&q->pending_cond);
+  list_init (&q->pending);
+  q->head = 0;
+
+  snprintf (thread_name, sizeof thread_name, "%s-io", name);
+  if (thread_create (thread_name, PRI_MAX, dispatcher, q) == TID_ERROR)
+    PANIC ("Failed to start dispatcher for %s", name);
+  return q;
+}
+
+/* Has requests to BLOCK go through Q.  Devices sharing a
+   controller that can only do one thing at a time should share
+   a queue. */
+void
+block_set_queue (struct block *block, struct block_queue *q)
+{
+  block->queue = q;
+}
+
+/* Chooses the next request to dispatch from Q, which must not be
+   empty.  Requests are serviced in C-LOOK order, that is, in
+   ascending order of sector from the head's current position,
+   then wrapping around to the lowest pending sector, except that
+   a request whose deadline has passed goes first. */
+static struct block_request *
+elevator_next (struct block_queue *q)
+{
+  struct block_request *oldest, *next, *lowest;
+  struct list_elem *e;
+
+  oldest = list_entry (list_front (&q->pending), struct block_request, elem);
+  if (timer_ticks () >= oldest->deadline)
+    return oldest;
+
+  next = lowest = NULL;
+  for (e = list_begin (&q->pending); e != list_end (&q->pending);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= q->head && (next == NULL || r->sector < next->sector))
+        next = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+    }
+  return next != NULL ? next : lowest;
+}
+
+/* Moves into BATCH every request in Q that extends BATCH's run
+   of sectors [*START, *START + *CNT) at either end, as long as the
+   run stays within BLOCK_MULTIPLE_MAX sectors. */
+static void
+merge_adjacent (struct block_queue *q, struct list *batch,
+                block_sector_t *start, size_t *cnt)
+{
+  struct block_request *first;
+  bool merged;
+
+  first = list_entry (list_front (batch), struct block_request, elem);
+  do
+    {
+      struct list_elem *e;
+
+      merged = false;
+      for (e = list_begin (&q->pending); e != list_end (&q->pending);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          if (r->block != first->block || r->write != first->write
+              || *cnt + r->cnt > BLOCK_MULTIPLE_MAX)
+            continue;
+
+          if (r->sector == *start + *cnt)
+            {
+              list_remove (&r->elem);
+              list_push_back (batch, &r->elem);
+            }
+          else if (r->sector + r->cnt == *start)
+            {
+              list_remove (&r->elem);
+              list_push_front (batch, &r->elem);
+              *start = r->sector;
+            }
+          else
+            continue;
+          *cnt += r->cnt;
+          merged = true;
+          break;
+        }
+    }
+  while (merged);
+}
+
+/* Dispatcher thread for the block_queue passed as QUEUE_.
+   Takes requests off the queue in elevator order, merges them
+   with any adjacent ones, and hands each merged run to the
+   driver as a single transfer. */
+static void
+dispatcher (void *queue_)
+{
+  struct block_queue *q = queue_;
+
+  for (;;)
+    {
+      void *buffers[BLOCK_MULTIPLE_MAX];
+      struct block_request *r;
+      struct list batch;
+      struct list_elem *e;
+      block_sector_t start;
+      size_t cnt;
+
+      lock_acquire (&q->lock);
+      while (list_empty (&q->pending))
+        cond_wait (&q->pending_cond, &q->lock);
+      r = elevator_next (q);
+      list_remove (&r->elem);
+      list_init (&batch);
+      list_push_back (&batch, &r->elem);
+      start = r->sector;
+      cnt = r->cnt;
+      merge_adjacent (q, &batch, &start, &cnt);
+      q->head = start + cnt;
+      lock_release (&q->lock);
+
+      /* Gather the buffers in sector order. */
+      cnt = 0;
+      for (e = list_begin (&batch); e != list_end (&batch); e = list_next (e))
+        {
+          size_t i;
+
+          r = list_entry (e, struct block_request, elem);
+          for (i = 0; i < r->cnt; i++)
+            buffers[cnt++] = r->buffers[i];
+        }
+      r = list_entry (list_front (&batch), struct block_request, elem);
+      transfer (r->block, start, cnt, buffers, r->write);
+
+      while (!list_empty (&batch))
+        {
+          r = list_entry (list_pop_front (&batch), struct block_request, elem);
+          complete (r);
+        }
+    }
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
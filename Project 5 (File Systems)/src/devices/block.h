@@ -1,6 +1,8 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -53,22 +55,104 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_readv (struct block *, block_sector_t, size_t cnt,
+                  void *const buffers[]);
+void block_writev (struct block *, block_sector_t, size_t cnt,
+                   const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+struct block_request;
+typedef void block_request_func (struct block_request *);
+
+/* A request to transfer CNT consecutive sectors, at most
+   BLOCK_MULTIPLE_MAX, to or from BLOCK.  The caller fills in
+   BLOCK, SECTOR, CNT, BUFFERS, WRITE, DONE and AUX, passes the request to
+   block_submit(), and must not touch it again until DONE is
+   called.  block_submit() may rewrite BLOCK and SECTOR to name
+   the underlying device, e.g. the disk that holds a partition. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in queue. */
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *const *buffers;               /* CNT sector-sized buffers. */
+    bool write;                         /* True to write, false to read. */
+    int64_t deadline;                   /* Tick by which to dispatch. */
+    struct block *origin;               /* Device originally named. */
+    uint64_t start_tsc;                 /* Time stamp counter at submit. */
+    block_request_func *done;           /* Called on completion. */
+    void *aux;                          /* For use by DONE. */
+  };
+
+void block_submit (struct block_request *);
+
 /* Statistics. */
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   requests that took between 2**I and 2**(I+1) - 1 time stamp
+   counter cycles, with the last bucket absorbing the rest. */
+#define BLOCK_LATENCY_BUCKETS 40
+
+/* I/O statistics for a block device.  The members from SEQ_CNT
+   through LATENCY stay zero unless block_detailed_stats is set. */
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Number of sectors read. */
+    unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long seq_cnt;         /* Requests that began where the
+                                           previous one ended. */
+    unsigned long long random_cnt;      /* Other requests. */
+    unsigned int depth;                 /* Requests currently in flight. */
+    unsigned int max_depth;             /* Peak of DEPTH. */
+    unsigned long long latency[BLOCK_LATENCY_BUCKETS];
+    unsigned long long flush_cnt;       /* Write-back passes over a cache
+                                           of this device. */
+    unsigned long long flush_write_cnt; /* Sectors those passes wrote. */
+    int64_t flush_ticks;                /* Timer ticks they took. */
+  };
+
+/* -iostat: Collect latency, locality and queue depth statistics. */
+extern bool block_detailed_stats;
+
+void block_get_stats (struct block *, struct block_stats *);
+void block_account_flush (struct block *, size_t cnt, int64_t ticks);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* Sectors per call to a driver's readv or writev operation. */
+#define BLOCK_MULTIPLE_MAX 64
+
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors, at most
+       BLOCK_MULTIPLE_MAX, starting at the given one, to or from
+       BUFFERS[0] through BUFFERS[CNT - 1].  If null, the block
+       layer calls READ or WRITE once per sector instead. */
+    void (*readv) (void *aux, block_sector_t, size_t cnt,
+                   void *const buffers[]);
+    void (*writev) (void *aux, block_sector_t, size_t cnt,
+                    const void *const buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
+
+/* Request queues. */
+struct block_queue *block_queue_create (const char *name);
+void block_set_queue (struct block *, struct block_queue *);
 
 #endif /* devices/block.h */
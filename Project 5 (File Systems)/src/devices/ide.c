@@ -8,7 +8,9 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +36,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +52,42 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+
+/* Most sectors we transfer per interrupt with READ/WRITE
+   MULTIPLE, even if the disk allows more. */
+#define MULTIPLE_MAX 16
+
+/* Bus master IDE port addresses, for controllers that follow
+   the PCI IDE bus master specification, such as the PIIX. */
+#define bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)     /* Status. */
+#define bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)       /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+#define BM_STA_IRQ 0x04         /* Interrupt (write 1 to clear). */
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA transfer.  A channel's PRD table must be 4-byte
+   aligned and must not cross a 64 kB boundary, nor may any
+   region. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes (0 means 64 kB). */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +96,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per READ/WRITE MULTIPLE
+                                   interrupt, or 0 if unsupported. */
+    bool dma;                   /* Transfer with bus-master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -71,6 +113,10 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct block_queue *queue;  /* Requests to this channel's devices. */
+
+    uint16_t bm_base;           /* Bus master base port, or 0 if none. */
+    struct prd *prdt;           /* PRD table, one page, if BM_BASE. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,11 +127,15 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+/* -dma: Use PCI bus-master DMA when possible. */
+bool ide_use_dma;
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, const uint16_t *id);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -97,12 +147,26 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static uint16_t find_bus_master (void);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          const void *const buffers[], bool write);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = 0;
   size_t chan_no;
 
+  if (ide_use_dma)
+    {
+      bm_base = find_bus_master ();
+      if (bm_base != 0)
+        printf ("ide: bus master DMA at port %#"PRIx16"\n", bm_base);
+      else
+        printf ("ide: no bus master IDE controller, using PIO\n");
+    }
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -126,6 +190,17 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->queue = NULL;
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          /* The secondary channel's registers follow the primary's.
+             A page-aligned page never crosses 64 kB. */
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +211,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -302,13 +379,51 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
+  set_multiple_mode (d, (const uint16_t *) id);
+
+  /* Word 49 bit 8: DMA supported. */
+  d->dma = c->bm_base != 0 && (((const uint16_t *) id)[49] & 0x100) != 0;
 
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+
+  /* Each channel's dispatcher runs independently of the other's,
+     so the two channels transfer data in parallel. */
+  if (c->queue == NULL)
+    c->queue = block_queue_create (c->name);
+  block_set_queue (block, c->queue);
   partition_scan (block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D, whose IDENTIFY DEVICE
+   data is ID, with as many sectors per interrupt as it supports
+   up to MULTIPLE_MAX.  Leaves D->MULTIPLE at 0 if the disk
+   doesn't support it or refuses the setting. */
+static void
+set_multiple_mode (struct ata_disk *d, const uint16_t *id)
+{
+  struct channel *c = d->channel;
+  int multiple = id[47] & 0xff;
+
+  if (multiple > MULTIPLE_MAX)
+    multiple = MULTIPLE_MAX;
+  if (multiple <= 1)
+    return;
+
+  /* The count must be a power of 2. */
+  while (multiple & (multiple - 1))
+    multiple &= multiple - 1;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -346,8 +461,16 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  if (d->dma)
+    {
+      const void *buffers[1] = { buffer };
+      lock_acquire (&c->lock);
+      dma_transfer (d, sec_no, 1, buffers, false);
+      lock_release (&c->lock);
+      return;
+    }
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sectors (d, sec_no, 1);
   issue_pio_command (c, CMD_READ_SECTOR_RETRY);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
@@ -366,8 +489,16 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  if (d->dma)
+    {
+      const void *buffers[1] = { buffer };
+      lock_acquire (&c->lock);
+      dma_transfer (d, sec_no, 1, buffers, true);
+      lock_release (&c->lock);
+      return;
+    }
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sectors (d, sec_no, 1);
   issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
   if (!wait_while_busy (d))
     PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
@@ -376,24 +507,111 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   lock_release (&c->lock);
 }
 
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFERS[0] through BUFFERS[CNT - 1] with a single command:
+   READ DMA if D uses DMA, which interrupts once at the end;
+   READ MULTIPLE if D supports it, which interrupts once per
+   D->MULTIPLE sectors; and otherwise READ SECTOR with a sector
+   count, which interrupts once per sector. */
+static void
+ide_readv (void *d_, block_sector_t sec_no, size_t cnt,
+           void *const buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  size_t per_irq = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= 256);
+
+  lock_acquire (&c->lock);
+  if (d->dma)
+    {
+      dma_transfer (d, sec_no, cnt, (const void *const *) buffers, false);
+      lock_release (&c->lock);
+      return;
+    }
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                        : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      if (i % per_irq == 0)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+        }
+      input_sector (c, buffers[i]);
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFERS[0] through BUFFERS[CNT - 1] with a single command, as
+   ide_readv() does for reads.  Returns after the disk has
+   acknowledged receiving all of the data. */
+static void
+ide_writev (void *d_, block_sector_t sec_no, size_t cnt,
+            const void *const buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  size_t per_irq = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= 256);
+
+  lock_acquire (&c->lock);
+  if (d->dma)
+    {
+      dma_transfer (d, sec_no, cnt, buffers, true);
+      lock_release (&c->lock);
+      return;
+    }
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                        : CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      /* The disk asks for the first block right away and for each
+         later one with an interrupt. */
+      if (i % per_irq == 0)
+        {
+          if (i > 0)
+            sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+        }
+      output_sector (c, buffers[i]);
+    }
+  sema_down (&c->completion_wait);
+  lock_release (&c->lock);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT, at most 256, to
+   the disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= 256);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -430,6 +648,137 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* PCI configuration space access mechanism #1. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit PCI configuration register at byte offset
+   REG of function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register at byte
+   offset REG of function FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, such as the PIIX that QEMU and Bochs emulate, and
+   enables bus mastering on it.  Returns the I/O port of its bus
+   master registers, or 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 01h (mass storage), subclass 01h (IDE), with
+           bit 7 of the programming interface (bus master). */
+        class = pci_read_config (dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+          continue;
+
+        /* BAR4 holds the bus master registers, in I/O space. */
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFERS[0] through BUFFERS[CNT - 1] with bus-master DMA,
+   writing to the disk if WRITE is true and reading from it
+   otherwise.  The disk raises a single interrupt when the whole
+   transfer is done.  The buffers must be in kernel memory, which
+   maps physical memory one-to-one.  D's channel lock must be
+   held. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *const buffers[], bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_sta, ata_sta;
+  size_t i, n = 0;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (cnt > 0 && cnt <= 256);
+
+  /* Describe the buffers, merging physically adjacent sectors and
+     splitting at 64 kB boundaries.  At most 2 descriptors per
+     sector, so 256 sectors fill the page exactly. */
+  for (i = 0; i < cnt; i++)
+    {
+      uintptr_t addr;
+      size_t left = BLOCK_SECTOR_SIZE;
+
+      ASSERT (is_kernel_vaddr (buffers[i]));
+      addr = vtop (buffers[i]);
+      while (left > 0)
+        {
+          size_t room = 0x10000 - (addr & 0xffff);
+          size_t size = left < room ? left : room;
+          struct prd *prev = n > 0 ? &c->prdt[n - 1] : NULL;
+
+          if (prev != NULL && prev->addr + prev->size == addr
+              && (addr & 0xffff) != 0 && prev->size + size < 0x10000)
+            prev->size += size;
+          else
+            {
+              c->prdt[n].addr = addr;
+              c->prdt[n].size = size;
+              c->prdt[n].flags = 0;
+              n++;
+            }
+          addr += size;
+          left -= size;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+
+  /* Program the bus master, clearing stale status, then start
+     it once the disk has the command. */
+  outl (bm_prdt (c), vtop (c->prdt));
+  outb (bm_command (c), direction);
+  outb (bm_status (c), inb (bm_status (c)) | BM_STA_ERR | BM_STA_IRQ);
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (bm_command (c), direction);
+  bm_sta = inb (bm_status (c));
+  outb (bm_status (c), bm_sta | BM_STA_ERR | BM_STA_IRQ);
+  ata_sta = inb (reg_alt_status (c));
+  if ((bm_sta & BM_STA_ERR) || (ata_sta & STA_ERR))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu, d->name,
+           write ? "write" : "read", sec_no);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
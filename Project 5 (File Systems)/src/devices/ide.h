@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* -dma: Use PCI bus-master DMA when the controller and disk
+   support it.  Set from the kernel command line before
+   ide_init(). */
+extern bool ide_use_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
@@ -0,0 +1,119 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in kernel memory, for measuring the CPU
+   cost of the file system without the cost of emulated disk
+   I/O.  Its contents are lost at shutdown.
+
+   The RAM disk is registered as a raw device named "ram0", so
+   it only takes on a role when named with -filesys, -scratch or
+   -swap.  Like the block layer's other devices, it does no
+   locking of its own: concurrent accesses to different sectors
+   are harmless, and the buffer cache keeps accesses to any one
+   sector in order. */
+
+/* Sectors per page of storage. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* -ramdisk: Size in sectors, or 0 for no RAM disk. */
+block_sector_t ramdisk_size;
+
+/* -ramdisk=...,preload: Fill the RAM disk from scratch. */
+bool ramdisk_preload;
+
+/* The RAM disk's block device and storage, one page per
+   SECTORS_PER_PAGE sectors.  Pages need not be contiguous. */
+static struct block *ramdisk;
+static uint8_t **pages;
+
+static struct block_operations ramdisk_operations;
+
+/* Returns the storage for SECTOR. */
+static uint8_t *
+sector_data (block_sector_t sector)
+{
+  return (pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Allocates and registers a zero-filled RAM disk of
+   ramdisk_size sectors, if ramdisk_size is nonzero.  Panics if
+   there is not enough memory. */
+void
+ramdisk_init (void)
+{
+  size_t page_cnt, i;
+
+  if (ramdisk_size == 0)
+    return;
+
+  page_cnt = DIV_ROUND_UP (ramdisk_size, SECTORS_PER_PAGE);
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ramdisk: out of memory for %zu-page table", page_cnt);
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ramdisk: out of memory after %zu of %zu pages",
+               i, page_cnt);
+    }
+
+  ramdisk = block_register ("ram0", BLOCK_RAW, "RAM disk", ramdisk_size,
+                            &ramdisk_operations, NULL);
+}
+
+/* Copies the beginning of SOURCE, up to the RAM disk's size,
+   into the RAM disk.  Does nothing if there is no RAM disk or
+   SOURCE is null. */
+void
+ramdisk_load (struct block *source)
+{
+  block_sector_t cnt, sector;
+
+  if (ramdisk == NULL || source == NULL)
+    return;
+  if (source == ramdisk)
+    PANIC ("ramdisk: cannot preload from itself");
+
+  cnt = block_size (source) < ramdisk_size ? block_size (source)
+                                           : ramdisk_size;
+  printf ("ramdisk: loading %'"PRDSNu" sectors from %s...",
+          cnt, block_name (source));
+  for (sector = 0; sector < cnt; sector += SECTORS_PER_PAGE)
+    {
+      block_sector_t chunk = cnt - sector;
+      if (chunk > SECTORS_PER_PAGE)
+        chunk = SECTORS_PER_PAGE;
+      block_read_multiple (source, sector, chunk, sector_data (sector));
+    }
+  printf ("done.\n");
+}
+
+/* Reads SECTOR into BUFFER. */
+static void
+ramdisk_read (void *aux UNUSED, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_data (sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BUFFER to SECTOR. */
+static void
+ramdisk_write (void *aux UNUSED, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_data (sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL
+  };
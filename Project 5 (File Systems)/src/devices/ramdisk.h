@@ -0,0 +1,16 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* -ramdisk: Size in sectors of the RAM disk, or 0 for none, and
+   whether to fill it from the scratch device at startup.  Set
+   from the kernel command line before ramdisk_init(). */
+extern block_sector_t ramdisk_size;
+extern bool ramdisk_preload;
+
+void ramdisk_init (void);
+void ramdisk_load (struct block *);
+
+#endif /* devices/ramdisk.h */
@@ -11,7 +11,9 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #endif
 
 /* Keyboard control register port. */
@@ -134,6 +136,10 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  journal_print_stats ();
+  inode_print_stats ();
+  dir_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -20,11 +21,24 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* A thread blocked in timer_sleep(). */
+struct sleeper
+  {
+    struct list_elem elem;      /* Element in sleepers. */
+    int64_t wake;               /* Tick to wake up at. */
+    struct semaphore sema;      /* Upped at WAKE. */
+  };
+
+/* Sleeping threads, in order of WAKE.  Accessed only with
+   interrupts off, since timer_interrupt() wakes them. */
+static struct list sleepers;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static list_less_func sleeper_less;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -36,6 +50,7 @@ void
 timer_init (void) 
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&sleepers);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -90,11 +105,30 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct sleeper s;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  /* Blocks instead of yielding, so that a sleeping thread costs
+     nothing until its time is up. */
+  s.wake = timer_ticks () + ticks;
+  sema_init (&s.sema, 0);
+  old_level = intr_disable ();
+  list_insert_ordered (&sleepers, &s.elem, sleeper_less, NULL);
+  intr_set_level (old_level);
+  sema_down (&s.sema);
+}
+
+/* Returns true if sleeper A wakes up before sleeper B. */
+static bool
+sleeper_less (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
+{
+  return (list_entry (a, struct sleeper, elem)->wake
+          < list_entry (b, struct sleeper, elem)->wake);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -172,6 +206,15 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  while (!list_empty (&sleepers))
+    {
+      struct sleeper *s = list_entry (list_front (&sleepers),
+                                      struct sleeper, elem);
+      if (s->wake > ticks)
+        break;
+      list_pop_front (&sleepers);
+      sema_up (&s->sema);
+    }
   thread_tick ();
 }
 
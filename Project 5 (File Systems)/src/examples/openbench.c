@@ -0,0 +1,82 @@
+/* openbench.c
+
+   Benchmarks the kernel's open inode table.  Builds a chain of
+   DEPTH nested directories holding FILES files, keeps all of the
+   files open, and then opens and closes each of them by its full
+   path ROUNDS times, so that every open looks its inodes up in a
+   table of at least FILES + 1 open inodes.  The kernel prints the
+   average cost of a lookup in its statistics at shutdown.
+
+   Usage: openbench [DEPTH [FILES [ROUNDS]]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+#define MAX_FILES 100
+
+int
+main (int argc, char *argv[])
+{
+  int depth = argc > 1 ? atoi (argv[1]) : 16;
+  int files = argc > 2 ? atoi (argv[2]) : 64;
+  int rounds = argc > 3 ? atoi (argv[3]) : 100;
+  int fds[MAX_FILES];
+  char path[256];
+  size_t dir_len;
+  int i, j;
+
+  if (depth < 0 || files < 1 || files > MAX_FILES || rounds < 1
+      || depth * 3 + 5 >= (int) sizeof path)
+    {
+      printf ("usage: %s [DEPTH [FILES (1-%d) [ROUNDS]]]\n",
+              argv[0], MAX_FILES);
+      return EXIT_FAILURE;
+    }
+
+  /* Create the directory chain /b/b/.../b. */
+  path[0] = '\0';
+  for (i = 0; i < depth; i++)
+    {
+      strlcat (path, "/b", sizeof path);
+      if (!mkdir (path))
+        {
+          printf ("%s: mkdir failed\n", path);
+          return EXIT_FAILURE;
+        }
+    }
+  dir_len = strlen (path);
+
+  /* Create the files and hold them open. */
+  for (i = 0; i < files; i++)
+    {
+      snprintf (path + dir_len, sizeof path - dir_len, "/f%d", i);
+      if (!create (path, 0) || (fds[i] = open (path)) < 0)
+        {
+          printf ("%s: create failed\n", path);
+          return EXIT_FAILURE;
+        }
+    }
+
+  for (j = 0; j < rounds; j++)
+    for (i = 0; i < files; i++)
+      {
+        int fd;
+
+        snprintf (path + dir_len, sizeof path - dir_len, "/f%d", i);
+        fd = open (path);
+        if (fd < 0)
+          {
+            printf ("%s: open failed\n", path);
+            return EXIT_FAILURE;
+          }
+        close (fd);
+      }
+
+  for (i = 0; i < files; i++)
+    close (fds[i]);
+  printf ("openbench: %d opens of files %d directories deep, "
+          "%d files held open\n", rounds * files, depth, files);
+  return EXIT_SUCCESS;
+}
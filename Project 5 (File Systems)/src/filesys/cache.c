@@ -0,0 +1,712 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Sector number of an entry that caches nothing. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* Maximum number of sectors waiting to be read ahead.  Further
+   requests are dropped until the read-ahead thread catches up. */
+#define READ_AHEAD_QUEUE_SIZE 64
+
+/* Most sectors written back, or read ahead, with one multi-sector
+   block device request. */
+#define CACHE_RUN_MAX 16
+
+/* A cached copy of one file system sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Cached sector, or NO_SECTOR. */
+    bool valid;                 /* Does DATA hold SECTOR's contents? */
+    bool dirty;                 /* Must DATA be written back? */
+    bool journaled;             /* Held back until its transaction
+                                   commits? */
+    bool accessed;              /* Clock reference bit. */
+    int pin_cnt;                /* Users; pinned entries aren't evicted. */
+    struct lock io_lock;        /* Serializes access to DATA. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+/* -cache: Number of sectors in the buffer cache. */
+size_t cache_size = CACHE_DEFAULT_SIZE;
+
+/* -flush: Milliseconds between passes of the flush daemon. */
+unsigned cache_flush_ms = CACHE_DEFAULT_FLUSH_MS;
+
+/* -dirty-ratio: Percentage of the cache that may be dirty before
+   the flush daemon is woken early. */
+unsigned cache_dirty_ratio = CACHE_DEFAULT_DIRTY_RATIO;
+
+static struct cache_entry *entries;     /* CACHE_SIZE entries. */
+static size_t clock_hand;               /* Next eviction candidate. */
+
+/* Protects every entry's SECTOR, ACCESSED and PIN_CNT members,
+   and CLOCK_HAND.  JOURNALED is also protected by CACHE_LOCK, but
+   is only set by the holder of the entry's IO_LOCK, so that lock
+   suffices to find it clear.  VALID, DIRTY and DATA belong to the holder of
+   the entry's IO_LOCK while it is pinned, and to CACHE_LOCK
+   otherwise.  CACHE_UNPINNED is signalled when an entry's
+   PIN_CNT drops to zero. */
+static struct lock cache_lock;
+static struct condition cache_unpinned;
+
+/* Number of dirty entries, whether the flush daemon should run
+   without waiting out its interval, and whether the interval is
+   up, all protected by CACHE_LOCK.  An entry's DIRTY member only
+   goes from false to true, or back, while CACHE_LOCK is held as
+   well.  FLUSH_PENDING is signalled when either flag is set. */
+static size_t dirty_cnt;
+static bool flush_wanted;
+static bool flush_due;
+static struct condition flush_pending;
+
+/* Circular queue of sectors for the read-ahead thread, also
+   protected by CACHE_LOCK.  READ_AHEAD_PENDING is signalled when
+   a sector is queued. */
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static size_t read_ahead_head;          /* Index of oldest request. */
+static size_t read_ahead_queued;        /* Number of queued requests. */
+static struct condition read_ahead_pending;
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Lookups found in cache. */
+static unsigned long long miss_cnt;     /* Lookups that went to disk. */
+static unsigned long long writeback_cnt; /* Dirty sectors written. */
+static unsigned long long read_ahead_cnt; /* Sectors read ahead. */
+static unsigned long long commit_wait_cnt; /* Misses that awaited a commit. */
+static unsigned long long early_cnt;    /* Flushes for the dirty ratio. */
+static unsigned long long direct_cnt;   /* Sectors written around cache. */
+
+static struct cache_entry *cache_get (block_sector_t, bool fill);
+static void cache_write_entry (block_sector_t, const void *,
+                               off_t size, off_t offset, bool meta);
+static void cache_put (struct cache_entry *);
+static void cache_unpin (struct cache_entry *);
+static void mark_dirty (struct cache_entry *);
+static struct cache_entry *lookup (block_sector_t);
+static void flush_daemon (void *aux);
+static void flush_timer (void *aux);
+static void read_ahead_daemon (void *aux);
+
+/* Initializes the buffer cache and starts the threads that
+   periodically write dirty sectors back to disk and that read
+   sectors ahead of sequential readers. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  if (cache_size < CACHE_MIN_SIZE)
+    cache_size = CACHE_MIN_SIZE;
+
+  entries = calloc (cache_size, sizeof *entries);
+  data = malloc (cache_size * BLOCK_SECTOR_SIZE);
+  if (entries == NULL || data == NULL)
+    PANIC ("couldn't allocate %zu-sector buffer cache", cache_size);
+
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *e = &entries[i];
+      e->sector = NO_SECTOR;
+      lock_init (&e->io_lock);
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  cond_init (&read_ahead_pending);
+  cond_init (&flush_pending);
+
+  thread_create ("cache-flush", PRI_MIN, flush_daemon, NULL);
+  if (cache_flush_ms > 0)
+    thread_create ("cache-flush-timer", PRI_DEFAULT, flush_timer, NULL);
+  thread_create ("cache-readahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Writes every dirty sector back to disk.  Called at file system
+   shutdown; the cache stays usable afterward. */
+void
+cache_done (void)
+{
+  cache_flush ();
+}
+
+/* Returns true if E caches a dirty sector that may be written
+   back.  CACHE_LOCK must be held.  The answer is only a hint
+   unless E's IO_LOCK is held. */
+static bool
+is_dirty (const struct cache_entry *e)
+{
+  return e != NULL && e->sector != NO_SECTOR && e->dirty && !e->journaled;
+}
+
+/* Writes the CNT entries in RUN, which cache consecutive sectors
+   starting at START, back to disk with one block device request
+   and marks them clean.  The caller must hold their IO_LOCKs. */
+static void
+write_run (struct cache_entry **run, size_t cnt, block_sector_t start)
+{
+  const void *buffers[CACHE_RUN_MAX];
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= CACHE_RUN_MAX);
+  for (i = 0; i < cnt; i++)
+    buffers[i] = run[i]->data;
+  block_writev (fs_device, start, cnt, buffers);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    run[i]->dirty = false;
+  dirty_cnt -= cnt;
+  writeback_cnt += cnt;
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache back to disk, except
+   those held back by the journal.  Dirty sectors that are
+   consecutive on disk are written with a single block device
+   request.  Every sector that is dirty, and not held back, for
+   the whole call is written, which the journal's checkpoints
+   rely on.  Returns the number of sectors written. */
+size_t
+cache_flush (void)
+{
+  size_t written = 0;
+  size_t i;
+
+  for (i = 0; i < cache_size; i++)
+    {
+      struct cache_entry *run[CACHE_RUN_MAX];
+      block_sector_t start;
+      size_t cnt, j, k;
+
+      lock_acquire (&cache_lock);
+      if (!is_dirty (&entries[i]))
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+
+      /* Find the run of dirty sectors around this one. */
+      start = entries[i].sector;
+      while (start > 0 && entries[i].sector - (start - 1) < CACHE_RUN_MAX
+             && is_dirty (lookup (start - 1)))
+        start--;
+      for (cnt = 0; cnt < CACHE_RUN_MAX; cnt++)
+        {
+          struct cache_entry *e = lookup (start + cnt);
+          if (!is_dirty (e))
+            break;
+          e->pin_cnt++;
+          run[cnt] = e;
+        }
+      lock_release (&cache_lock);
+
+      /* Waiting only for the first IO_LOCK keeps this from
+         deadlocking with the read-ahead thread, which also holds
+         several.  The run ends at the first entry that is busy or
+         that was written back meanwhile. */
+      lock_acquire (&run[0]->io_lock);
+      for (j = 1; j < cnt; j++)
+        if (!lock_try_acquire (&run[j]->io_lock))
+          break;
+        else if (!run[j]->dirty || run[j]->journaled)
+          {
+            lock_release (&run[j]->io_lock);
+            break;
+          }
+
+      if (run[0]->dirty && !run[0]->journaled)
+        {
+          write_run (run, j, start);
+          written += j;
+        }
+      for (k = 0; k < j; k++)
+        cache_put (run[k]);
+
+      /* The entries cut off the run may sit earlier in ENTRIES,
+         where this pass won't come back to them, so write them
+         one at a time now, holding no other IO_LOCK. */
+      for (k = j; k < cnt; k++)
+        {
+          lock_acquire (&run[k]->io_lock);
+          if (run[k]->dirty && !run[k]->journaled)
+            {
+              write_run (&run[k], 1, start + k);
+              written++;
+            }
+          cache_put (run[k]);
+        }
+    }
+  return written;
+}
+
+/* Commits the journal's running transaction and writes every
+   dirty sector back to disk, so that everything in the buffer
+   cache survives a crash.  Data held back by delayed allocation
+   is not in the cache yet; see inode_flush(). */
+void
+cache_sync (void)
+{
+  int64_t start = timer_ticks ();
+  size_t written;
+
+  journal_commit ();
+  written = cache_flush ();
+  block_account_flush (fs_device, written, timer_elapsed (start));
+}
+
+/* Reads sector SECTOR of the file system device into BUFFER,
+   which must have room for BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET within sector SECTOR
+   of the file system device into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t size, off_t offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + offset, size);
+  cache_put (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR
+   of the file system device.  The data reaches the disk when
+   the sector is evicted or flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes from BUFFER starting at byte OFFSET within
+   sector SECTOR of the file system device.  The rest of the
+   sector is read from disk first unless it is already cached or
+   the write covers the whole sector. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                off_t size, off_t offset)
+{
+  cache_write_entry (sector, buffer, size, offset, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER to
+   sector SECTOR of the file system device, as part of the
+   journal's running transaction. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer)
+{
+  cache_write_meta_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Like cache_write_at(), but for metadata: the sector joins the
+   journal's running transaction and is not written back in place
+   until that transaction commits. */
+void
+cache_write_meta_at (block_sector_t sector, const void *buffer,
+                     off_t size, off_t offset)
+{
+  cache_write_entry (sector, buffer, size, offset, true);
+}
+
+/* Writes the CNT whole sectors of data in BUFFER to the file
+   system device starting at SECTOR, around the buffer cache:
+   sectors that happen to be cached are updated there, and runs
+   of the others go straight to disk with as few block device
+   requests as possible.  Meant for large writes that would
+   otherwise push everything else out of the cache a sector at a
+   time.  Nobody else may be able to reach the sectors until this
+   returns. */
+void
+cache_write_multiple (block_sector_t sector, size_t cnt, const void *buffer)
+{
+  const uint8_t *data = buffer;
+  size_t run = 0;               /* Uncached sectors not yet written. */
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      bool cached;
+
+      lock_acquire (&cache_lock);
+      cached = lookup (sector + i) != NULL;
+      if (!cached)
+        direct_cnt++;
+      lock_release (&cache_lock);
+      if (!cached)
+        {
+          run++;
+          continue;
+        }
+
+      if (run > 0)
+        block_write_multiple (fs_device, sector + i - run, run,
+                              data + (i - run) * BLOCK_SECTOR_SIZE);
+      run = 0;
+      cache_write (sector + i, data + i * BLOCK_SECTOR_SIZE);
+    }
+  if (run > 0)
+    block_write_multiple (fs_device, sector + cnt - run, run,
+                          data + (cnt - run) * BLOCK_SECTOR_SIZE);
+}
+
+/* Lets SECTOR, whose transaction has committed, be written back,
+   unless it has joined the running transaction since. */
+void
+cache_unjournal (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = lookup (sector);
+  if (e != NULL && e->journaled && !journal_pending (sector))
+    {
+      e->journaled = false;
+      cond_signal (&cache_unpinned, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR of the file system
+   device into the cache, without waiting for it.  The request is
+   dropped if SECTOR is already cached or the queue is full. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (lookup (sector) == NULL && read_ahead_queued < READ_AHEAD_QUEUE_SIZE)
+    {
+      size_t tail = read_ahead_head + read_ahead_queued;
+      read_ahead_queue[tail % READ_AHEAD_QUEUE_SIZE] = sector;
+      read_ahead_queued++;
+      cond_signal (&read_ahead_pending, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %zu sectors, %llu hits, %llu misses, "
+          "%llu write-backs, %llu read-aheads, %llu commit waits, "
+          "%llu early flushes, %llu direct writes\n",
+          cache_size, hit_cnt, miss_cnt, writeback_cnt,
+          read_ahead_cnt, commit_wait_cnt, early_cnt, direct_cnt);
+}
+
+/* Writes SIZE bytes from BUFFER at byte OFFSET within SECTOR.
+   If META is true, the sector is metadata for the journal. */
+static void
+cache_write_entry (block_sector_t sector, const void *buffer,
+                   off_t size, off_t offset, bool meta)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + offset, buffer, size);
+  e->valid = true;
+  if (!e->dirty || meta)
+    {
+      lock_acquire (&cache_lock);
+      mark_dirty (e);
+      if (meta)
+        e->journaled = journal_add (sector) || e->journaled;
+      lock_release (&cache_lock);
+    }
+  cache_put (e);
+}
+
+/* Marks E dirty, waking the flush daemon early if that brings
+   the cache to its dirty ratio.  CACHE_LOCK and E's IO_LOCK must
+   be held. */
+static void
+mark_dirty (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  if (e->dirty)
+    return;
+
+  e->dirty = true;
+  dirty_cnt++;
+  if (dirty_cnt * 100 >= cache_size * cache_dirty_ratio && !flush_wanted)
+    {
+      flush_wanted = true;
+      cond_signal (&flush_pending, &cache_lock);
+    }
+}
+
+/* Returns the entry caching SECTOR, or a null pointer if there
+   is none.  CACHE_LOCK must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  for (i = 0; i < cache_size; i++)
+    if (entries[i].sector == sector)
+      return &entries[i];
+  return NULL;
+}
+
+/* Picks an unpinned entry to reuse with the clock algorithm,
+   writing it back first if it is dirty.  Entries the journal is
+   holding back are passed over.  Returns a null pointer if there
+   is no candidate.  CACHE_LOCK must be held; it is released while
+   a victim is written back, so the caller must look again for
+   anything it found missing before. */
+static struct cache_entry *
+evict (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  for (i = 0; i < 2 * cache_size; i++)
+    {
+      struct cache_entry *e = &entries[clock_hand];
+      clock_hand = (clock_hand + 1) % cache_size;
+
+      if (e->pin_cnt > 0 || e->journaled)
+        continue;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      /* Written back pinned, without CACHE_LOCK.  E keeps its
+         SECTOR meanwhile, so a miss on that sector finds E and
+         waits for its IO_LOCK instead of reading stale data from
+         disk.  E is only taken if nobody used it in the meantime. */
+      if (e->dirty)
+        {
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->io_lock);
+          if (e->dirty && !e->journaled)
+            {
+              block_write (fs_device, e->sector, e->data);
+              lock_acquire (&cache_lock);
+              e->dirty = false;
+              dirty_cnt--;
+              writeback_cnt++;
+              lock_release (&cache_lock);
+            }
+          cache_put (e);
+          lock_acquire (&cache_lock);
+          if (e->pin_cnt > 0 || e->accessed || e->dirty || e->journaled)
+            continue;
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns the pinned entry for SECTOR with its IO_LOCK held,
+   loading it into the cache if necessary.  If FILL is false the
+   caller is about to overwrite the whole sector, so a missing
+   sector is not read from disk.  Release with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool fill)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector != NO_SECTOR);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          hit_cnt++;
+          break;
+        }
+
+      e = evict ();
+      if (e != NULL && lookup (sector) != NULL)
+        continue;               /* Loaded while evict() wrote back. */
+      if (e != NULL)
+        {
+          miss_cnt++;
+          e->sector = sector;
+          e->valid = false;
+          break;
+        }
+
+      /* Every unpinned entry is held back by the journal.  Writing
+         one in place before its transaction commits would break
+         the journal's ordering, so ask the flush daemon for a
+         commit and wait for it, or for an unpin.  Transactions
+         are kept to a fraction of the cache (see journal_begin()
+         and write_pieces()), so the operations in progress can
+         always finish and let the commit go ahead. */
+      commit_wait_cnt++;
+      if (!flush_wanted)
+        {
+          flush_wanted = true;
+          cond_signal (&flush_pending, &cache_lock);
+        }
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->io_lock);
+  if (!e->valid && fill)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->io_lock);
+  cache_unpin (e);
+}
+
+/* Drops a pin on entry E, whose IO_LOCK the caller doesn't hold. */
+static void
+cache_unpin (struct cache_entry *e)
+{
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Every CACHE_FLUSH_MS milliseconds, or sooner once the cache
+   reaches its dirty ratio, allocates data held back by delayed
+   allocation, commits the journal's running transaction, which
+   includes the free map, and writes dirty sectors back to disk,
+   bounding how much data a crash can lose.  Sleeps until
+   mark_dirty() or flush_timer() wakes it. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+      while (!flush_wanted && !flush_due)
+        cond_wait (&flush_pending, &cache_lock);
+      if (flush_wanted)
+        early_cnt++;
+      flush_wanted = flush_due = false;
+      lock_release (&cache_lock);
+
+      inode_flush_all ();
+      cache_sync ();
+    }
+}
+
+/* Wakes the flush daemon every CACHE_FLUSH_MS milliseconds.  Not
+   started if CACHE_FLUSH_MS is 0. */
+static void
+flush_timer (void *aux UNUSED)
+{
+  int64_t interval = (int64_t) cache_flush_ms * TIMER_FREQ / 1000;
+
+  if (interval == 0)
+    interval = 1;
+  for (;;)
+    {
+      timer_sleep (interval);
+      lock_acquire (&cache_lock);
+      flush_due = true;
+      cond_signal (&flush_pending, &cache_lock);
+      lock_release (&cache_lock);
+    }
+}
+
+/* Removes and returns the oldest sector in the read-ahead queue,
+   which must not be empty.  CACHE_LOCK must be held. */
+static block_sector_t
+read_ahead_pop (void)
+{
+  block_sector_t sector = read_ahead_queue[read_ahead_head];
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (read_ahead_queued > 0);
+  read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+  read_ahead_queued--;
+  return sector;
+}
+
+/* Services cache_read_ahead() requests, loading each queued
+   sector that is not already cached.  Queued sectors that follow
+   one another on disk are read with a single block device
+   request. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  static uint8_t scratch[BLOCK_SECTOR_SIZE];
+
+  /* Leave most of the cache unpinned for everyone else. */
+  size_t run_max = cache_size / 4 < CACHE_RUN_MAX ? cache_size / 4
+                                                   : CACHE_RUN_MAX;
+
+  for (;;)
+    {
+      struct cache_entry *run[CACHE_RUN_MAX];
+      void *buffers[CACHE_RUN_MAX];
+      block_sector_t start;
+      size_t cnt, i;
+
+      lock_acquire (&cache_lock);
+      while (read_ahead_queued == 0)
+        cond_wait (&read_ahead_pending, &cache_lock);
+      start = read_ahead_pop ();
+      if (lookup (start) != NULL)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      for (cnt = 1; cnt < run_max && read_ahead_queued > 0
+                    && read_ahead_queue[read_ahead_head] == start + cnt
+                    && lookup (start + cnt) == NULL; cnt++)
+        read_ahead_pop ();
+      lock_release (&cache_lock);
+
+      /* Claim entries without reading them, then fill the ones
+         that are still empty with one request.  Sectors somebody
+         else loaded meanwhile are read into SCRATCH and dropped. */
+      for (i = 0; i < cnt; i++)
+        {
+          run[i] = cache_get (start + i, false);
+          buffers[i] = run[i]->valid ? scratch : run[i]->data;
+        }
+      block_readv (fs_device, start, cnt, buffers);
+      for (i = 0; i < cnt; i++)
+        {
+          run[i]->valid = true;
+          cache_put (run[i]);
+        }
+      read_ahead_cnt += cnt;
+    }
+}
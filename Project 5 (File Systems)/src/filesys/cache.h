@@ -0,0 +1,53 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "devices/block.h"
+
+/* Default number of sectors held by the buffer cache. */
+#define CACHE_DEFAULT_SIZE 64
+
+/* Smallest buffer cache we allow, so that a few concurrent
+   inode operations can always pin the sectors they need. */
+#define CACHE_MIN_SIZE 8
+
+/* -cache: Number of sectors in the buffer cache.
+   Set from the kernel command line before cache_init(). */
+extern size_t cache_size;
+
+/* Default interval between passes of the flush daemon, in
+   milliseconds. */
+#define CACHE_DEFAULT_FLUSH_MS 5000
+
+/* Default percentage of the cache that may be dirty before the
+   flush daemon is woken ahead of schedule. */
+#define CACHE_DEFAULT_DIRTY_RATIO 50
+
+/* -flush: Milliseconds between passes of the flush daemon, or 0
+   to flush only on demand and when the dirty ratio is reached. */
+extern unsigned cache_flush_ms;
+
+/* -dirty-ratio: Percentage of the cache, from 1 to 100, that may
+   be dirty before the flush daemon is woken early. */
+extern unsigned cache_dirty_ratio;
+
+void cache_init (void);
+void cache_done (void);
+size_t cache_flush (void);
+void cache_sync (void);
+
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, off_t size, off_t offset);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, off_t size, off_t offset);
+void cache_write_meta (block_sector_t, const void *);
+void cache_write_meta_at (block_sector_t, const void *,
+                          off_t size, off_t offset);
+void cache_write_multiple (block_sector_t, size_t cnt, const void *);
+void cache_unjournal (block_sector_t);
+void cache_read_ahead (block_sector_t);
+
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
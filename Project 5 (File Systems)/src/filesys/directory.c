@@ -1,6 +1,7 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -12,6 +13,7 @@ struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    struct dir_index *index;            /* Name index. */
   };
 
 /* A single directory entry. */
@@ -22,18 +24,101 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of the entries of one directory, shared by
+   every open `struct dir' for it.  Built by reading the whole
+   directory the first time it is opened and kept coherent by
+   dir_add() and dir_remove(), so lookups never touch the disk.
+   Its NAMES, FREE_SLOTS and END are protected by the directory
+   inode's lock (see inode_lock_dir()); the rest by
+   dir_indexes_lock. */
+struct dir_index
+  {
+    struct hash_elem elem;              /* Element in dir_indexes. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    int open_cnt;                       /* Number of `struct dir's. */
+    struct hash names;                  /* `struct dir_name's by name. */
+    struct list free_slots;             /* `struct dir_name's not in use. */
+    off_t end;                          /* Offset just past last entry. */
+  };
+
+/* An entry in a directory's index: a name in use, or a free slot
+   that dir_add() can fill. */
+struct dir_name
+  {
+    union
+      {
+        struct hash_elem hash_elem;     /* Element in NAMES if in use. */
+        struct list_elem list_elem;     /* Element in FREE_SLOTS if not. */
+      };
+    off_t ofs;                          /* Byte offset of the dir_entry. */
+    block_sector_t inode_sector;        /* Sector of the entry's inode. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Directory indexes of all open directories, by sector. */
+static struct hash dir_indexes;
+static struct lock dir_indexes_lock;
+
+/* Number of path components remembered by the dentry cache. */
+#define DENTRY_CACHE_SIZE 256
+
+/* A path component resolved by dir_lookup_sector(): NAME in the
+   directory whose inode is in sector PARENT.  Negative entries
+   record that NAME does not exist there. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in dentry_lru. */
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool negative;                      /* NAME doesn't exist? */
+    block_sector_t inode_sector;        /* NAME's inode sector. */
+    bool is_dir;                        /* Is NAME a directory? */
+  };
+
+/* Dentry cache, by parent and name, most recently used first.
+   dir_add() and dir_remove() drop the entry for the name they
+   change.  A directory can only be removed once empty, so the
+   only entries left under a removed directory's sector are
+   negative ones, which stay true if the sector is reused for a
+   new directory. */
+static struct hash dentries;
+static struct list dentry_lru;
+static size_t dentry_cnt;
+static struct lock dentries_lock;
+
+static unsigned long long dentry_hit_cnt;   /* Lookups answered. */
+static unsigned long long dentry_miss_cnt;  /* Lookups that read dirs. */
+
+static hash_hash_func dentry_hash, dir_index_hash;
+static hash_less_func dentry_less, dir_index_less;
+static void dentry_invalidate (const struct dir *, const char *name);
+static bool dentry_is_dir (block_sector_t parent, const char *name,
+                           block_sector_t inode_sector, bool *is_dir);
+
+static struct dir_index *dir_index_get (struct inode *);
+static void dir_index_put (struct dir_index *);
+static bool dir_index_add (struct dir_index *, const struct dir_entry *,
+                           off_t ofs);
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  if (!hash_init (&dir_indexes, dir_index_hash, dir_index_less, NULL)
+      || !hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("can't allocate directory caches");
+  lock_init (&dir_indexes_lock);
+  list_init (&dentry_lru);
+  lock_init (&dentries_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  if (!inode_create(sector, entry_cnt * sizeof (struct dir_entry)))return false;
-
-  struct inode *node = inode_open(sector);
-  inode_set_isdir(node, true);
-  inode_close(node);
-
-  return true;
+  return inode_create(sector, entry_cnt * sizeof (struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -42,7 +127,8 @@ struct dir *
 dir_open (struct inode *inode) 
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL
+      && (dir->index = dir_index_get (inode)) != NULL)
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -78,6 +164,7 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      dir_index_put (dir->index);
       inode_close (dir->inode);
       free (dir);
     }
@@ -99,23 +186,29 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_name key, *n;
+  struct hash_elem *h;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) {
-    if (e.in_use && !strcmp (name, e.name)) {
-      if (ep != NULL)
-        *ep = e;
-      if (ofsp != NULL)
-        *ofsp = ofs;
-      return true;
+  if (strlen (name) > NAME_MAX)
+    return false;
+  strlcpy (key.name, name, sizeof key.name);
+  h = hash_find (&dir->index->names, &key.hash_elem);
+  if (h == NULL)
+    return false;
+
+  n = hash_entry (h, struct dir_name, hash_elem);
+  if (ep != NULL)
+    {
+      ep->inode_sector = n->inode_sector;
+      strlcpy (ep->name, n->name, sizeof ep->name);
+      ep->in_use = true;
     }
-  }
-  return false;
+  if (ofsp != NULL)
+    *ofsp = n->ofs;
+  return true;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -132,20 +225,150 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (name != NULL);
 
   if (!strcmp(name, ".")) {
-    *inode = dir_get_inode(dir);
+    *inode = inode_reopen(dir_get_inode(dir));
   } else if (!strcmp(name, "..")) {
     *inode = inode_get_parent_inode(dir_get_inode(dir));
   } else {
+    inode_lock_dir (dir->inode);
     if (lookup (dir, name, &e, NULL)) {
       *inode = inode_open (e.inode_sector);
     } else {
       *inode = NULL;
     }
+    inode_unlock_dir (dir->inode);
   }
 
   return *inode != NULL;
 }
 
+/* Looks up NAME in the directory whose inode is in sector
+   DIR_SECTOR without opening either one if the dentry cache
+   already knows the answer.  Returns true if NAME exists, in
+   which case *INODE_SECTOR and *IS_DIR describe its inode.
+   Returns false if it doesn't, or if DIR_SECTOR is not a
+   directory. */
+bool
+dir_lookup_sector (block_sector_t dir_sector, const char *name,
+                   block_sector_t *inode_sector, bool *is_dir)
+{
+  struct dentry key, *d;
+  struct hash_elem *h;
+  struct inode *dir_inode, *inode = NULL;
+  struct dir_entry e;
+  struct dir *dir;
+  bool found;
+
+  ASSERT (name != NULL);
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  key.parent = dir_sector;
+  strlcpy (key.name, name, sizeof key.name);
+  lock_acquire (&dentries_lock);
+  h = hash_find (&dentries, &key.hash_elem);
+  if (h != NULL)
+    {
+      d = hash_entry (h, struct dentry, hash_elem);
+      list_remove (&d->lru_elem);
+      list_push_front (&dentry_lru, &d->lru_elem);
+      dentry_hit_cnt++;
+      *inode_sector = d->inode_sector;
+      *is_dir = d->is_dir;
+      found = !d->negative;
+      lock_release (&dentries_lock);
+      return found;
+    }
+  dentry_miss_cnt++;
+  lock_release (&dentries_lock);
+
+  /* Ask the directory itself. */
+  dir_inode = inode_open (dir_sector);
+  if (dir_inode == NULL || !inode_isdir (dir_inode))
+    {
+      inode_close (dir_inode);
+      return false;
+    }
+  dir = dir_open (dir_inode);
+  if (dir == NULL)
+    return false;
+
+  /* "." and ".." are not directory entries, so dir_add() and
+     dir_remove() would never invalidate them.  Don't cache them. */
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    {
+      found = dir_lookup (dir, name, &inode);
+      if (found)
+        {
+          *inode_sector = inode_get_inumber (inode);
+          *is_dir = inode_isdir (inode);
+          inode_close (inode);
+        }
+      dir_close (dir);
+      return found;
+    }
+
+  /* Hold the directory's lock until the answer is cached, so that
+     a concurrent dir_add() or dir_remove() can't invalidate the
+     entry before it is inserted. */
+  inode_lock_dir (dir->inode);
+  found = lookup (dir, name, &e, NULL);
+  if (found)
+    {
+      inode = inode_open (e.inode_sector);
+      if (inode == NULL)
+        {
+          inode_unlock_dir (dir->inode);
+          dir_close (dir);
+          return false;
+        }
+      *inode_sector = e.inode_sector;
+      *is_dir = inode_isdir (inode);
+    }
+
+  /* Remember the answer, recycling the least recently used entry
+     once the cache is full. */
+  lock_acquire (&dentries_lock);
+  if (dentry_cnt < DENTRY_CACHE_SIZE)
+    {
+      d = malloc (sizeof *d);
+      if (d != NULL)
+        dentry_cnt++;
+    }
+  else
+    {
+      d = list_entry (list_pop_back (&dentry_lru), struct dentry, lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+    }
+  if (d != NULL)
+    {
+      d->parent = dir_sector;
+      strlcpy (d->name, name, sizeof d->name);
+      d->negative = !found;
+      d->inode_sector = found ? *inode_sector : 0;
+      d->is_dir = found && *is_dir;
+      h = hash_replace (&dentries, &d->hash_elem);
+      if (h != NULL)
+        {
+          /* Another thread cached the same answer meanwhile. */
+          struct dentry *old = hash_entry (h, struct dentry, hash_elem);
+          list_remove (&old->lru_elem);
+          free (old);
+          dentry_cnt--;
+        }
+      list_push_front (&dentry_lru, &d->lru_elem);
+    }
+  lock_release (&dentries_lock);
+
+  /* Closing INODE may be its last close, which can write it back
+     in a journal operation of its own, so it must not happen
+     under the directory's lock. */
+  inode_unlock_dir (dir->inode);
+  inode_close (inode);
+  dir_close (dir);
+  return found;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -167,28 +390,37 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
+  inode_lock_dir (dir->inode);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+     current end-of-file. */
+  if (!list_empty (&dir->index->free_slots))
+    ofs = list_entry (list_front (&dir->index->free_slots),
+                      struct dir_name, list_elem)->ofs;
+  else
+    ofs = dir->index->end;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success && !dir_index_add (dir->index, &e, ofs))
+    {
+      /* Lookups go through the index, so take the entry back out
+         rather than leave it unreachable. */
+      e.in_use = false;
+      inode_write_at (dir->inode, &e, sizeof e, ofs);
+      success = false;
+    }
+  if (success)
+    dentry_invalidate (dir, name);
   
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
@@ -207,6 +439,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  inode_lock_dir (dir->inode);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -217,31 +450,30 @@ dir_remove (struct dir *dir, const char *name)
 
   // check if removing the dir is legal (empty and not in use)
   if (inode_isdir(inode)) {
-    struct dir *deaddir = dir_open(inode);
-    struct dir_entry e2;
-    off_t ofs2;
-    bool empty = true;
-    for (ofs2 = 0;
-       inode_read_at (deaddir->inode, &e2, sizeof e2, ofs2) == sizeof e2;
-       ofs2 += sizeof e2)
-       if (e2.in_use) {
-         empty = false;
-         break;
-       }
+    struct dir *deaddir = dir_open(inode_reopen(inode));
+    bool empty = false;
+    if (deaddir != NULL) {
+      inode_lock_dir(inode);
+      empty = hash_empty (&deaddir->index->names);
+      inode_unlock_dir(inode);
+    }
     dir_close(deaddir);
-    if (!empty || dir_get_inode(thread_current()->cwd) == inode) return false;
+    if (!empty || dir_get_inode(thread_current()->cwd) == inode) goto done;
   }
 
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dir_index_add (dir->index, &e, ofs);
+  dentry_invalidate (dir, name);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -253,15 +485,342 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  inode_lock_dir (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  inode_unlock_dir (dir->inode);
+  return found;
+}
+
+/* Number of directory entries dir_readdir_many() reads from the
+   directory inode at once. */
+#define READDIR_BATCH 16
+
+/* Reads up to CNT of the next entries in DIR into RECORDS, in
+   batches of READDIR_BATCH, and returns the number read.  Fewer
+   than CNT means the directory has no more entries.  Shares its
+   position with dir_readdir(). */
+size_t
+dir_readdir_many (struct dir *dir, struct dir_record *records, size_t cnt)
+{
+  struct dir_entry batch[READDIR_BATCH];
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  size_t found = 0;
+  size_t i;
+
+  inode_lock_dir (dir->inode);
+  while (found < cnt)
+    {
+      off_t bytes = inode_read_at (dir->inode, batch, sizeof batch,
+                                   dir->pos);
+      size_t entry_cnt = bytes / sizeof *batch;
+
+      if (entry_cnt == 0)
+        break;
+      for (i = 0; i < entry_cnt && found < cnt; i++)
+        {
+          struct dir_entry *e = &batch[i];
+          dir->pos += sizeof *e;
+          if (e->in_use)
+            {
+              struct dir_record *r = &records[found++];
+              r->inode_sector = e->inode_sector;
+              strlcpy (r->name, e->name, sizeof r->name);
+            }
+        }
+    }
+  inode_unlock_dir (dir->inode);
+
+  /* Directory entries don't record their type.  The dentry cache
+     usually knows it, and opening an inode that is already open
+     is cheap, but any other entry still costs a read of its inode
+     sector.  That happens without the directory's lock, so that
+     closing the inode can write it back (see dir_lookup_sector()),
+     and an entry removed meanwhile may be reported as a file. */
+  for (i = 0; i < found; i++)
+    {
+      struct dir_record *r = &records[i];
+
+      if (!dentry_is_dir (dir_sector, r->name, r->inode_sector, &r->is_dir))
+        {
+          struct inode *inode = inode_open (r->inode_sector);
+          r->is_dir = inode != NULL && inode_isdir (inode);
+          inode_close (inode);
+        }
+    }
+  return found;
+}
+
+/* Prints dentry cache statistics. */
+void
+dir_print_stats (void)
+{
+  printf ("Dentry cache: %zu entries, %llu hits, %llu misses\n",
+          dentry_cnt, dentry_hit_cnt, dentry_miss_cnt);
+}
+
+/* Dentry cache. */
+
+/* Returns true if the dentry cache knows that NAME in the
+   directory whose inode is in sector PARENT has its inode in
+   sector INODE_SECTOR, storing whether it is a directory in
+   *IS_DIR.  Unlike dir_lookup_sector(), never reads the disk. */
+static bool
+dentry_is_dir (block_sector_t parent, const char *name,
+               block_sector_t inode_sector, bool *is_dir)
+{
+  struct dentry key, *d;
+  struct hash_elem *h;
+  bool found = false;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  lock_acquire (&dentries_lock);
+  h = hash_find (&dentries, &key.hash_elem);
+  if (h != NULL)
+    {
+      d = hash_entry (h, struct dentry, hash_elem);
+      if (!d->negative && d->inode_sector == inode_sector)
+        {
+          *is_dir = d->is_dir;
+          found = true;
+        }
+    }
+  lock_release (&dentries_lock);
+  return found;
+}
+
+/* Returns the hash value for `struct dentry' E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Returns true if dentry A sorts before dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Forgets whatever the dentry cache knows about NAME in DIR. */
+static void
+dentry_invalidate (const struct dir *dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *h;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  key.parent = inode_get_inumber (dir->inode);
+  strlcpy (key.name, name, sizeof key.name);
+  lock_acquire (&dentries_lock);
+  h = hash_delete (&dentries, &key.hash_elem);
+  if (h != NULL)
+    {
+      struct dentry *d = hash_entry (h, struct dentry, hash_elem);
+      list_remove (&d->lru_elem);
+      free (d);
+      dentry_cnt--;
+    }
+  lock_release (&dentries_lock);
+}
+
+/* Directory name index. */
+
+/* Returns the hash value for the name in `struct dir_name' E. */
+static unsigned
+dir_name_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_name, hash_elem)->name);
+}
+
+/* Returns true if the name in A sorts before the one in B. */
+static bool
+dir_name_less (const struct hash_elem *a, const struct hash_elem *b,
+               void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_name, hash_elem)->name,
+                 hash_entry (b, struct dir_name, hash_elem)->name) < 0;
+}
+
+/* Returns the hash value for `struct dir_index' E. */
+static unsigned
+dir_index_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct dir_index, elem)->sector);
+}
+
+/* Returns true if index A's directory has a lower sector than
+   index B's. */
+static bool
+dir_index_less (const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+  return (hash_entry (a, struct dir_index, elem)->sector
+          < hash_entry (b, struct dir_index, elem)->sector);
+}
+
+/* Frees `struct dir_name' E. */
+static void
+dir_name_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_name, hash_elem));
+}
+
+/* Frees INDEX and everything in it. */
+static void
+dir_index_free (struct dir_index *index)
+{
+  while (!list_empty (&index->free_slots))
+    free (list_entry (list_pop_front (&index->free_slots),
+                      struct dir_name, list_elem));
+  hash_destroy (&index->names, dir_name_free);
+  free (index);
+}
+
+/* Records entry E, at byte offset OFS of INDEX's directory, in
+   INDEX, replacing whatever it recorded for that offset.
+   Returns false if memory is short.  INDEX has then forgotten
+   the slot, which for a free slot only costs dir_add() the
+   chance to reuse it. */
+static bool
+dir_index_add (struct dir_index *index, const struct dir_entry *e, off_t ofs)
+{
+  struct dir_name *n = NULL;
+
+  /* Take over the record for OFS, if there is one.  dir_add()
+     always fills the slot at the front of FREE_SLOTS, so a free
+     slot's record can only be there; the other callers add
+     entries that were in use or that are new to the index. */
+  if (!list_empty (&index->free_slots)
+      && list_entry (list_front (&index->free_slots),
+                     struct dir_name, list_elem)->ofs == ofs)
+    n = list_entry (list_pop_front (&index->free_slots),
+                    struct dir_name, list_elem);
+  if (n == NULL && e->in_use == false)
+    {
+      struct dir_name key;
+      struct hash_elem *h;
+      strlcpy (key.name, e->name, sizeof key.name);
+      h = hash_find (&index->names, &key.hash_elem);
+      if (h != NULL && hash_entry (h, struct dir_name, hash_elem)->ofs == ofs)
+        n = hash_entry (hash_delete (&index->names, h),
+                        struct dir_name, hash_elem);
+    }
+  if (n == NULL)
+    n = malloc (sizeof *n);
+  if (n == NULL)
+    return false;
+
+  n->ofs = ofs;
+  n->inode_sector = e->inode_sector;
+  strlcpy (n->name, e->name, sizeof n->name);
+  if (e->in_use)
+    hash_insert (&index->names, &n->hash_elem);
+  else
+    list_push_front (&index->free_slots, &n->list_elem);
+  if (ofs + (off_t) sizeof *e > index->end)
+    index->end = ofs + sizeof *e;
+  return true;
+}
+
+/* Returns the index of directory INODE, building it from the
+   directory's contents if no open `struct dir' has it yet.
+   Returns a null pointer if memory is short. */
+static struct dir_index *
+dir_index_get (struct inode *inode)
+{
+  struct dir_index key, *index;
+  struct dir_entry entries[BLOCK_SECTOR_SIZE / sizeof (struct dir_entry)];
+  struct hash_elem *h;
+  off_t ofs, size;
+
+  /* Holding the directory's lock while building keeps out both
+     concurrent changes and a second builder. */
+  inode_lock_dir (inode);
+  key.sector = inode_get_inumber (inode);
+  lock_acquire (&dir_indexes_lock);
+  h = hash_find (&dir_indexes, &key.elem);
+  if (h != NULL)
+    {
+      index = hash_entry (h, struct dir_index, elem);
+      index->open_cnt++;
+      lock_release (&dir_indexes_lock);
+      inode_unlock_dir (inode);
+      return index;
+    }
+  lock_release (&dir_indexes_lock);
+
+  index = malloc (sizeof *index);
+  if (index == NULL
+      || !hash_init (&index->names, dir_name_hash, dir_name_less, NULL))
+    {
+      free (index);
+      inode_unlock_dir (inode);
+      return NULL;
+    }
+  index->sector = key.sector;
+  index->open_cnt = 1;
+  list_init (&index->free_slots);
+  index->end = 0;
+
+  /* Read the directory a sector's worth of entries at a time. */
+  for (ofs = 0;
+       (size = inode_read_at (inode, entries, sizeof entries, ofs)) > 0;
+       ofs += size)
+    {
+      off_t i;
+      for (i = 0; i + (off_t) sizeof *entries <= size; i += sizeof *entries)
+        {
+          const struct dir_entry *e = &entries[i / sizeof *entries];
+          if (!dir_index_add (index, e, ofs + i) && e->in_use)
+            {
+              dir_index_free (index);
+              inode_unlock_dir (inode);
+              return NULL;
+            }
+        }
+      if (size < (off_t) sizeof *entries)
+        break;
+    }
+
+  lock_acquire (&dir_indexes_lock);
+  hash_insert (&dir_indexes, &index->elem);
+  lock_release (&dir_indexes_lock);
+  inode_unlock_dir (inode);
+  return index;
+}
+
+/* Drops a reference to INDEX, freeing it once no open `struct
+   dir' uses it. */
+static void
+dir_index_put (struct dir_index *index)
+{
+  lock_acquire (&dir_indexes_lock);
+  if (--index->open_cnt == 0)
+    hash_delete (&dir_indexes, &index->elem);
+  else
+    index = NULL;
+  lock_release (&dir_indexes_lock);
+
+  if (index != NULL)
+    dir_index_free (index);
 }
@@ -13,6 +13,16 @@
 
 struct inode;
 
+/* A directory entry as returned by dir_readdir_many(). */
+struct dir_record
+  {
+    block_sector_t inode_sector;        /* Sector of the entry's inode. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -26,5 +36,11 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_many (struct dir *, struct dir_record *, size_t cnt);
+
+/* Path resolution. */
+bool dir_lookup_sector (block_sector_t dir_sector, const char *name,
+                        block_sector_t *inode_sector, bool *is_dir);
+void dir_print_stats (void);
 
 #endif /* filesys/directory.h */
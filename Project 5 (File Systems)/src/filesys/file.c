@@ -1,16 +1,28 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in bytes.  The window starts at the
+   minimum on the first sequential read and doubles on each
+   following one. */
+#define READ_AHEAD_MIN (2 * BLOCK_SECTOR_SIZE)
+#define READ_AHEAD_MAX (16 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of data already read ahead. */
+    off_t ra_window;            /* Read-ahead size, 0 if not sequential. */
   };
 
+static void file_read_ahead (struct file *, off_t pos, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +35,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -41,13 +56,15 @@ file_reopen (struct file *file)
   return file_open (inode_reopen (file->inode));
 }
 
-/* Closes FILE. */
+/* Closes FILE, first allocating disk sectors for any of its
+   data held back by delayed allocation. */
 void
 file_close (struct file *file) 
 {
   if (file != NULL)
     {
       file_allow_write (file);
+      inode_flush (file->inode);
       inode_close (file->inode);
       free (file); 
     }
@@ -69,10 +86,44 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Updates FILE's sequential access state after reading
+   BYTES_READ bytes at offset POS.  A read that starts where the
+   previous one ended grows the read-ahead window and queues the
+   data that follows it; any other read collapses the window. */
+static void
+file_read_ahead (struct file *file, off_t pos, off_t bytes_read)
+{
+  off_t start, end;
+
+  if (pos != file->ra_next || bytes_read == 0)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+      file->ra_next = pos + bytes_read;
+      return;
+    }
+
+  if (file->ra_window == 0)
+    file->ra_window = READ_AHEAD_MIN;
+  else if (file->ra_window < READ_AHEAD_MAX)
+    file->ra_window *= 2;
+  file->ra_next = pos + bytes_read;
+
+  /* Only queue what earlier calls have not already asked for. */
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -2,17 +2,26 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Sector number of a path component that does not exist. */
+#define NO_SECTOR ((block_sector_t) -1)
+
 static void do_format (void);
+static bool resolve_path (const char *path, block_sector_t *parent,
+                          char name[NAME_MAX + 1], block_sector_t *sector);
+static bool open_parent (const char *path, struct dir **dir,
+                         char name[NAME_MAX + 1], block_sector_t *sector);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -23,11 +32,24 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
+  else
+    {
+      /* New inodes keep the layout chosen when the disk was
+         formatted, which the root directory's inode records. */
+      struct inode *root = inode_open (ROOT_DIR_SECTOR);
+      if (root == NULL)
+        PANIC ("can't open root directory");
+      inode_use_extents = inode_has_extents (root);
+      inode_close (root);
+    }
 
   free_map_open ();
 }
@@ -37,7 +59,11 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_flush_all ();
+  journal_done ();
+  inode_write_dirty ();
   free_map_close ();
+  cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -48,21 +74,57 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   struct dir *parent_dir;
-  char *file_name;
-  if (!filesys_check_path(name, &parent_dir, &file_name)) return false;
+  char file_name[NAME_MAX + 1];
+  journal_begin();
+  if (!filesys_check_path(name, &parent_dir, file_name)) {
+    journal_end();
+    return false;
+  }
 
+  bool success = filesys_create_at (parent_dir, file_name, initial_size,
+                                    false, NULL);
+  dir_close(parent_dir);
+  journal_end();
+
+  return success;
+}
+
+/* Creates NAME in directory DIR, without resolving a path: an
+   ordinary file of INITIAL_SIZE bytes, or an empty directory if
+   IS_DIR is true.  If INODEP is non-null and creation succeeds,
+   stores the new inode, opened, into *INODEP; the caller must
+   close it.  Returns true if successful, false otherwise. */
+bool
+filesys_create_at (struct dir *dir, const char *name, off_t initial_size,
+                   bool is_dir, struct inode **inodep)
+{
+  block_sector_t parent = inode_get_inumber (dir_get_inode (dir));
   block_sector_t inode_sector = 0;
-  bool success = (parent_dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (parent_dir, file_name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  
-  struct inode *node = inode_open(inode_sector);
-  inode_set_parent_inode(node, inode_get_inumber(dir_get_inode(parent_dir)));
-  inode_close(node);
+  struct inode *inode = NULL;
+  journal_begin();
 
+  // place the new inode near its parent directory's
+  bool success = (free_map_allocate_near (1, parent, &inode_sector)
+                  && (is_dir
+                      ? dir_create (inode_sector, 16)
+                      : inode_create (inode_sector, initial_size, false))
+                  && (inode = inode_open (inode_sector)) != NULL
+                  && dir_add (dir, name, inode_sector));
+  if (success)
+    inode_set_parent_inode(inode, parent);
+  else
+    {
+      inode_close(inode);
+      inode = NULL;
+      if (inode_sector != 0)
+        free_map_release (inode_sector, 1);
+    }
+  journal_end();
+
+  if (inodep != NULL)
+    *inodep = inode;
+  else
+    inode_close(inode);
   return success;
 }
 
@@ -75,7 +137,7 @@ struct file *
 filesys_open (const char *name)
 {
   struct inode *inode;
-  if (!filesys_parse_path(name, &inode, NULL)) return NULL;
+  if (!filesys_parse_path(name, &inode)) return NULL;
 
   return file_open(inode);
 }
@@ -87,22 +149,29 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct inode *inode;
-  char *file_name;
-  if (!filesys_parse_path(name, &inode, &file_name)) return false;
+  struct dir *dir;
+  block_sector_t sector;
+  char file_name[NAME_MAX + 1];
+  journal_begin();
+  if (!open_parent(name, &dir, file_name, &sector)) {
+    journal_end();
+    return false;
+  }
 
-  struct dir *dir = dir_open(inode_get_parent_inode(inode));
-  bool success = dir != NULL && dir_remove (dir, file_name);
+  // dir_remove() looks FILE_NAME up again under the directory's lock
+  bool success = sector != NO_SECTOR && dir_remove (dir, file_name);
   dir_close (dir); 
+  journal_end();
 
   return success;
 }
-
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
-  printf ("Formatting file system...");
+  printf ("Formatting file system%s...",
+          inode_use_extents ? " with extent-based inodes" : "");
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
@@ -110,81 +179,114 @@ do_format (void)
   printf ("done.\n");
 }
 
-// Parses the path name, returning true if the file/dir exists,
-// storing the inode in output
-bool filesys_parse_path (const char *path, struct inode **output, char **name) {
-  int len = strlen(path) + 1;
-  char *_path = malloc(len * sizeof(char));
-  strlcpy(_path, path, len);
+// Walks PATH, relative to the current directory unless it starts with '/'.
+// Stores the sector of the directory holding the last component in *PARENT,
+// the component itself in NAME (empty if PATH names the starting directory),
+// and its inode sector, or NO_SECTOR if it doesn't exist, in *SECTOR.
+// Returns false if PATH is empty or an earlier component is missing or not a
+// directory.  Components are resolved through the dentry cache, so paths
+// seen before don't touch directory data.
+static bool resolve_path (const char *path, block_sector_t *parent,
+                          char name[NAME_MAX + 1], block_sector_t *sector) {
+  struct dir *cwd = thread_current()->cwd;
+  char *_path, *token, *next_token, *saveptr;
+  bool is_dir = true;
+  bool success = true;
 
-  if (*_path == '\0') return false;
+  if (*path == '\0') return false;
+  _path = malloc(strlen(path) + 1);
+  if (_path == NULL) return false;
+  strlcpy(_path, path, strlen(path) + 1);
 
-  struct dir *curr_dir;
   // check if absolute or relative path
-  if (*_path == '/') {
-    curr_dir = dir_open_root();
-  } else {
-    curr_dir = thread_current()->cwd;
-    if (!curr_dir) curr_dir = dir_open_root();
+  if (*path == '/' || cwd == NULL) *sector = ROOT_DIR_SECTOR;
+  else *sector = inode_get_inumber(dir_get_inode(cwd));
+  *parent = *sector;
+  name[0] = '\0';
+
+  for (token = strtok_r(_path, "/", &saveptr); token != NULL;
+       token = next_token) {
+    next_token = strtok_r(NULL, "/", &saveptr);
+    // the previous component must be an existing directory
+    if (*sector == NO_SECTOR || !is_dir || strlen(token) > NAME_MAX) {
+      success = false;
+      break;
+    }
+    *parent = *sector;
+    strlcpy(name, token, NAME_MAX + 1);
+    if (!dir_lookup_sector(*parent, token, sector, &is_dir))
+      *sector = NO_SECTOR;
   }
 
-  char *saveptr;
-  char *token = strtok_r(_path, "/", &saveptr);
-  struct inode *curr_inode = dir_get_inode(curr_dir);
-  while (token != NULL) {
-    if (name) *name = token;
-    if (!dir_lookup(curr_dir, token, &curr_inode)) return false;
-    if (!inode_isdir(curr_inode)) {
-      *output = curr_inode;
+  free(_path);
+  return success;
+}
+
+// Opens the directory holding the last component of PATH into *DIR and
+// stores that component in NAME and its sector, or NO_SECTOR, in *SECTOR.
+// The sectors resolve_path() returns are only hints: nothing keeps a
+// directory alive between the lookup and the open, so an rmdir could free
+// its sector for something else to reuse.  Once the directory is open its
+// sector can't be reused, so the path is resolved again and the directory
+// kept only if it still comes back.  *SECTOR stays a hint; callers that act
+// on the entry must look NAME up again in *DIR under its lock.
+static bool open_parent (const char *path, struct dir **dir,
+                         char name[NAME_MAX + 1], block_sector_t *sector) {
+  block_sector_t parent, check;
+  struct inode *inode;
+
+  if (!resolve_path(path, &parent, name, sector)) return false;
+  for (;;) {
+    inode = inode_open(parent);
+    if (inode != NULL && inode_isdir(inode)) {
+      *dir = dir_open(inode);
+      if (*dir == NULL) return false;
+    } else {
+      inode_close(inode);
+      *dir = NULL;
+    }
+    if (!resolve_path(path, &check, name, sector)) {
+      dir_close(*dir);
+      return false;
+    }
+    if (check == parent) {
+      // Out of memory, or the parent really isn't a directory.
+      if (*dir == NULL) return false;
       return true;
     }
-    // else, keep going deeper
-    curr_dir = dir_open(curr_inode);
-    token = strtok_r(NULL, "/", &saveptr);
+    dir_close(*dir);
+    parent = check;
   }
+}
 
-  // this means the end is a directory
-  *output = curr_inode;
-  return true;
+// Parses the path name, returning true if the file/dir exists,
+// storing the inode in output.  The caller must close it.
+bool filesys_parse_path (const char *path, struct inode **output) {
+  block_sector_t sector;
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+
+  if (!open_parent(path, &dir, name, &sector)) return false;
+  // open the entry under the parent's lock rather than by its sector
+  if (name[0] == '\0') *output = inode_reopen(dir_get_inode(dir));
+  else if (sector == NO_SECTOR || !dir_lookup(dir, name, output))
+    *output = NULL;
+  dir_close(dir);
+  return *output != NULL;
 }
 
 // Similar to filesys_parse_path, but instead checks if this path is viable
-// to create a new file/directory, and returns the parent in output
-bool filesys_check_path (const char *path, struct dir **output, char **name) {
-  int len = strlen(path) + 1;
-  char *_path = malloc(len * sizeof(char));
-  strlcpy(_path, path, len);
-  if (*_path == '\0') return false;
-
-  struct dir *curr_dir;
-  // check if absolute or relative path
-  if (*_path == '/') {
-    curr_dir = dir_open_root();
-  } else {
-    curr_dir = thread_current()->cwd;
-    if (!curr_dir) curr_dir = dir_open_root();
-  }
+// to create a new file/directory, and returns the parent in output and the
+// new file's name in name.  The caller must close the parent.  dir_add()
+// rejects the name if it was created in the meantime.
+bool filesys_check_path (const char *path, struct dir **output,
+                         char name[NAME_MAX + 1]) {
+  block_sector_t sector;
 
-  char *saveptr, *next_token;
-  char *token = strtok_r(_path, "/", &saveptr);
-  struct inode *curr_inode;
-  while (token != NULL) {
-    next_token = strtok_r(NULL, "/", &saveptr);
-    if (!dir_lookup(curr_dir, token, &curr_inode)) {
-      if (next_token) {
-        // intermediate directory doesnt exist
-        return false;
-      } else {
-        // final location doesnt exist => available
-        *output = curr_dir;
-        *name = token;
-        return true;
-      }
-    }
-    curr_dir = dir_open(curr_inode);
-    token = next_token;
+  if (!open_parent(path, output, name, &sector)) return false;
+  if (sector != NO_SECTOR || name[0] == '\0') {
+    dir_close(*output);
+    return false;
   }
-
-  // this means the final location exists => not available
-  return false;
+  return true;
 }
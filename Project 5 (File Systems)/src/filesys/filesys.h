@@ -10,16 +10,23 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* Metadata journal: a header sector followed by the log. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
+#define JOURNAL_SECTORS 128     /* Sectors reserved for the journal. */
+
 /* Block device that contains the file system. */
 struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_create_at (struct dir *, const char *name, off_t initial_size,
+                        bool is_dir, struct inode **);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
 
-bool filesys_parse_path (const char *path, struct inode **output, char **name);
-bool filesys_check_path (const char *path, struct dir **output, char **name);
+bool filesys_parse_path (const char *path, struct inode **output);
+bool filesys_check_path (const char *path, struct dir **output,
+                         char name[NAME_MAX + 1]);
 
 #endif /* filesys/filesys.h */
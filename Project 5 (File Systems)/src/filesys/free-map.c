@@ -1,13 +1,55 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of free map bits stored in one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Number of sectors in a block group.  Allocations start looking
+   in the group holding their goal sector and move on to the
+   following groups, skipping those too full to help. */
+#define GROUP_SECTORS 1024
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* One bit per sector of the free map file, set if that part of
+   FREE_MAP has changed since it was last written out.
+
+   Allocations and releases only update FREE_MAP and DIRTY_MAP.
+   free_map_flush() writes the changed sectors into the buffer
+   cache as metadata.  The journal calls it at the start of each
+   commit, once no operation is in progress, so every transaction
+   carries a free map that matches the inodes committed with it. */
+static struct bitmap *dirty_map;
+
+/* Number of sectors clear in FREE_MAP, and how many of those
+   free_map_reserve() has set aside for delayed allocations.
+   free_map_allocate() leaves reserved sectors alone; only
+   free_map_claim() may take them. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+/* Number of sectors clear in FREE_MAP within each block group. */
+static size_t *group_free;
+static size_t group_cnt;
+
+/* Protects FREE_MAP, DIRTY_MAP, FREE_CNT, RESERVED_CNT and
+   GROUP_FREE. */
+static struct lock free_map_lock;
+
+static block_sector_t allocate (size_t cnt, block_sector_t goal);
+static void count_free (void);
+static void mark_dirty (block_sector_t, size_t cnt);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,26 +57,94 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("dirty map creation failed");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = calloc (group_cnt, sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("block group table creation failed");
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (bitmap_size (free_map) > JOURNAL_SECTOR + JOURNAL_SECTORS)
+    bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  count_free ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Like free_map_allocate(), but prefers the first run at or
+   after sector GOAL within GOAL's block group, then runs in the
+   groups after it. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (free_cnt - reserved_cnt >= cnt)
+    sector = allocate (cnt, goal);
+  lock_release (&free_map_lock);
+
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
+}
+
+/* Sets aside CNT free sectors, which are allocated later with
+   free_map_claim() or given back with free_map_unreserve().
+   Returns false if fewer than CNT unreserved sectors are free. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Like free_map_allocate_near(), but takes the CNT sectors out
+   of those set aside by free_map_reserve().  Reserved sectors
+   need not be consecutive, so this can still fail unless CNT is
+   1. */
+bool
+free_map_claim (size_t cnt, block_sector_t goal, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  sector = allocate (cnt, goal);
+  if (sector != BITMAP_ERROR)
+    reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
@@ -44,9 +154,38 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  size_t i;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_cnt += cnt;
+  for (i = 0; i < cnt; i++)
+    group_free[(sector + i) / GROUP_SECTORS]++;
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the parts of the free map changed since the last flush
+   to the free map file. */
+void
+free_map_flush (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; free_map_file != NULL && i < bitmap_size (dirty_map); i++)
+    if (bitmap_test (dirty_map, i))
+      {
+        size_t start = i * BITS_PER_SECTOR;
+        size_t cnt = bit_cnt - start < BITS_PER_SECTOR
+                     ? bit_cnt - start : BITS_PER_SECTOR;
+        if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+          PANIC ("can't write free map");
+        bitmap_reset (dirty_map, i);
+      }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +197,20 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  lock_acquire (&free_map_lock);
+  count_free ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,13 +218,99 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  Writing fills the file's sectors,
+     which allocates under the file's inode lock, so the flush
+     daemon, which locks in the opposite order, must not see the
+     file until that is done. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  lock_acquire (&free_map_lock);
+  free_map_file = file;
+  lock_release (&free_map_lock);
+}
+
+/* Allocates CNT consecutive sectors from the free map and
+   returns the first, or BITMAP_ERROR if there is no such run.
+   Looks first at or after GOAL in GOAL's block group, then in
+   each following group with enough free sectors, wrapping
+   around to the start of GOAL's group, and finally anywhere,
+   for runs that only fit across a group boundary.
+   FREE_MAP_LOCK must be held. */
+static block_sector_t
+allocate (size_t cnt, block_sector_t goal)
+{
+  size_t first, i;
+  block_sector_t sector = BITMAP_ERROR;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  first = goal / GROUP_SECTORS;
+  for (i = 0; i <= group_cnt && sector == BITMAP_ERROR; i++)
+    {
+      size_t group = (first + i) % group_cnt;
+      block_sector_t start = i == 0 ? goal : group * GROUP_SECTORS;
+      block_sector_t end = (group + 1) * GROUP_SECTORS;
+
+      if (group_free[group] >= cnt)
+        {
+          sector = bitmap_scan (free_map, start, cnt, false);
+          if (sector != BITMAP_ERROR && sector >= end)
+            sector = BITMAP_ERROR;
+        }
+    }
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+
+  if (sector != BITMAP_ERROR)
+    {
+      size_t j;
+
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      free_cnt -= cnt;
+      for (j = 0; j < cnt; j++)
+        group_free[(sector + j) / GROUP_SECTORS]--;
+      mark_dirty (sector, cnt);
+      journal_revoke (sector, cnt);
+    }
+  return sector;
+}
+
+/* Recomputes FREE_CNT and GROUP_FREE from FREE_MAP. */
+static void
+count_free (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t group;
+
+  free_cnt = 0;
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = bit_cnt - start < GROUP_SECTORS
+                   ? bit_cnt - start : GROUP_SECTORS;
+      group_free[group] = bitmap_count (free_map, start, cnt, false);
+      free_cnt += group_free[group];
+    }
+}
+
+/* Records that the free map bits for CNT sectors starting at
+   SECTOR have changed.  FREE_MAP_LOCK must be held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, first, last - first + 1, true);
 }
@@ -10,8 +10,14 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (size_t, block_sector_t goal, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
 
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+bool free_map_claim (size_t, block_sector_t goal, block_sector_t *);
+
 #endif /* filesys/free-map.h */
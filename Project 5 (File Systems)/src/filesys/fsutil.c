@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +8,10 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -67,20 +70,203 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Sectors of the scratch device read with one request while
+   extracting.  One such chunk is read while the previous one is
+   copied into the file system. */
+#define EXTRACT_SECTORS BLOCK_MULTIPLE_MAX
+
+/* Sequential reader of the scratch device that keeps the next
+   chunk's read in flight, double buffered. */
+struct scratch_stream
+  {
+    struct block *block;                /* Scratch device. */
+    block_sector_t next;                /* First sector of next chunk. */
+    uint8_t *buffers[2];                /* EXTRACT_SECTORS sectors each. */
+    void *sectors[EXTRACT_SECTORS];     /* Sectors of the chunk read. */
+    int cur;                            /* Buffer being consumed. */
+    size_t pos, cnt;                    /* Sectors used, and held, in it. */
+    struct block_request request;       /* Read of the other buffer. */
+    struct semaphore done;              /* Upped when it completes. */
+    bool pending;                       /* Is the read in flight? */
+  };
+
+/* Wakes the reader waiting for scratch read R. */
+static void
+stream_read_done (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Starts reading the next chunk of S into the buffer not being
+   consumed, unless the device is exhausted. */
+static void
+stream_start (struct scratch_stream *s)
+{
+  block_sector_t size = block_size (s->block);
+  uint8_t *buffer = s->buffers[!s->cur];
+  size_t i;
+
+  if (s->next >= size)
+    return;
+  s->request.cnt = (size - s->next < EXTRACT_SECTORS
+                    ? size - s->next : EXTRACT_SECTORS);
+  for (i = 0; i < s->request.cnt; i++)
+    s->sectors[i] = buffer + i * BLOCK_SECTOR_SIZE;
+  s->request.block = s->block;
+  s->request.sector = s->next;
+  s->request.buffers = s->sectors;
+  s->request.write = false;
+  s->request.done = stream_read_done;
+  s->request.aux = &s->done;
+  s->pending = true;
+  s->next += s->request.cnt;
+  block_submit (&s->request);
+}
+
+/* Opens S for reading BLOCK from its first sector. */
+static void
+stream_open (struct scratch_stream *s, struct block *block)
+{
+  s->block = block;
+  s->next = 0;
+  s->buffers[0] = palloc_get_multiple (PAL_ASSERT, EXTRACT_SECTORS
+                                       * BLOCK_SECTOR_SIZE / PGSIZE);
+  s->buffers[1] = palloc_get_multiple (PAL_ASSERT, EXTRACT_SECTORS
+                                       * BLOCK_SECTOR_SIZE / PGSIZE);
+  s->cur = 0;
+  s->pos = s->cnt = 0;
+  sema_init (&s->done, 0);
+  s->pending = false;
+  stream_start (s);
+}
+
+/* Returns the next sectors of S, at least one and at most MAX,
+   and stores how many into *CNT.  They stay valid until the next
+   call. */
+static const uint8_t *
+stream_read (struct scratch_stream *s, size_t max, size_t *cnt)
+{
+  const uint8_t *data;
+
+  if (s->pos == s->cnt)
+    {
+      /* Switch to the chunk read meanwhile and start on the
+         next. */
+      if (!s->pending)
+        PANIC ("archive runs past end of scratch device");
+      sema_down (&s->done);
+      s->pending = false;
+      s->cur = !s->cur;
+      s->pos = 0;
+      s->cnt = s->request.cnt;
+      stream_start (s);
+    }
+
+  *cnt = s->cnt - s->pos < max ? s->cnt - s->pos : max;
+  data = s->buffers[s->cur] + s->pos * BLOCK_SECTOR_SIZE;
+  s->pos += *cnt;
+  return data;
+}
+
+/* Returns the scratch sector that S reads next. */
+static block_sector_t
+stream_tell (const struct scratch_stream *s)
+{
+  return s->next - (s->pending ? s->request.cnt : 0) - (s->cnt - s->pos);
+}
+
+/* Waits for S's read in flight, if any, and frees its buffers. */
+static void
+stream_close (struct scratch_stream *s)
+{
+  if (s->pending)
+    sema_down (&s->done);
+  palloc_free_multiple (s->buffers[0],
+                        EXTRACT_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE);
+  palloc_free_multiple (s->buffers[1],
+                        EXTRACT_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE);
+}
+
+/* Directory that the last archive entry went into, with its path
+   in the archive, so that runs of entries in one directory, or
+   in its subdirectories, don't each walk their paths from the
+   root. */
+struct extract_dir
+  {
+    struct dir *dir;
+    char path[USTAR_HEADER_SIZE];
+  };
+
+/* Makes D the directory at PATH, of LENGTH bytes, creating any
+   directories along the way that don't exist yet.  Starts from
+   D's current directory if PATH lies within it. */
+static void
+extract_chdir (struct extract_dir *d, const char *path, size_t length)
+{
+  size_t cur = strlen (d->path);
+  char *copy, *token, *save_ptr;
+
+  if (cur == length && !memcmp (d->path, path, length))
+    return;
+  if (cur == 0
+      || (cur < length && !memcmp (d->path, path, cur) && path[cur] == '/'))
+    path += cur;
+  else
+    {
+      dir_close (d->dir);
+      d->dir = dir_open_root ();
+      if (d->dir == NULL)
+        PANIC ("root dir open failed");
+      cur = 0;
+    }
+  memcpy (d->path, path - cur, length);
+  d->path[length] = '\0';
+
+  copy = malloc (length - cur + 1);
+  if (copy == NULL)
+    PANIC ("couldn't allocate path buffer");
+  strlcpy (copy, path, length - cur + 1);
+  for (token = strtok_r (copy, "/", &save_ptr); token != NULL;
+       token = strtok_r (NULL, "/", &save_ptr))
+    {
+      struct inode *inode;
+
+      if (!strcmp (token, "."))
+        continue;
+      if (!dir_lookup (d->dir, token, &inode)
+          && !filesys_create_at (d->dir, token, 0, true, &inode))
+        PANIC ("%s: directory creation failed", d->path);
+      if (!inode_isdir (inode))
+        PANIC ("%s: not a directory", d->path);
+      dir_close (d->dir);
+      d->dir = dir_open (inode);
+      if (d->dir == NULL)
+        PANIC ("%s: open failed", d->path);
+    }
+  free (copy);
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.
+
+   The archive is streamed: the next chunk of the scratch device
+   is read while the last is written out, each file's sectors are
+   allocated up front in as few runs as possible and written
+   around the buffer cache, and directories are only looked up
+   again when the archive moves on to another one. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
-  static block_sector_t sector = 0;
+  /* Too big for the kernel stack. */
+  static struct scratch_stream stream;
+  static struct extract_dir dir;
 
   struct block *src;
-  void *header, *data;
+  void *header;
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
+  if (header == NULL)
     PANIC ("couldn't allocate buffers");
 
   /* Open source block device. */
@@ -91,18 +277,26 @@ fsutil_extract (char **argv UNUSED)
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
 
+  stream_open (&stream, src);
+  dir.dir = dir_open_root ();
+  if (dir.dir == NULL)
+    PANIC ("root dir open failed");
+  dir.path[0] = '\0';
   for (;;)
     {
       const char *file_name;
       const char *error;
       enum ustar_type type;
+      size_t cnt;
       int size;
 
-      /* Read and parse ustar header. */
-      block_read (src, sector++, header);
+      /* Read and parse ustar header.  FILE_NAME points into
+         HEADER, which the stream's buffers soon overwrite. */
+      memcpy (header, stream_read (&stream, 1, &cnt), BLOCK_SECTOR_SIZE);
       error = ustar_parse_header (header, &file_name, &type, &size);
       if (error != NULL)
-        PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
+        PANIC ("bad ustar header in sector %"PRDSNu" (%s)",
+               stream_tell (&stream) - 1, error);
 
       if (type == USTAR_EOF)
         {
@@ -110,37 +304,62 @@ fsutil_extract (char **argv UNUSED)
           break;
         }
       else if (type == USTAR_DIRECTORY)
-        printf ("ignoring directory %s\n", file_name);
+        {
+          size_t length = strlen (file_name);
+
+          printf ("Putting directory '%s' into the file system...\n",
+                  file_name);
+          while (length > 0 && file_name[length - 1] == '/')
+            length--;
+          if (strcmp (file_name, "."))
+            extract_chdir (&dir, file_name, length);
+        }
       else if (type == USTAR_REGULAR)
         {
-          struct file *dst;
+          const char *name = strrchr (file_name, '/');
+          struct inode *dst;
+          off_t ofs = 0;
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
-          /* Create destination file. */
-          if (!filesys_create (file_name, size))
+          /* Create destination file, all of its sectors at once. */
+          if (name != NULL)
+            extract_chdir (&dir, file_name, name++ - file_name);
+          else
+            {
+              extract_chdir (&dir, "", 0);
+              name = file_name;
+            }
+          if (!filesys_create_at (dir.dir, name, 0, false, &dst))
             PANIC ("%s: create failed", file_name);
-          dst = filesys_open (file_name);
-          if (dst == NULL)
-            PANIC ("%s: open failed", file_name);
+          if (!inode_preallocate (dst, size))
+            PANIC ("%s: out of disk space", file_name);
 
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
-              if (file_write (dst, data, chunk_size) != chunk_size)
+              const uint8_t *data;
+              int chunk_size;
+
+              data = stream_read (&stream, DIV_ROUND_UP (size,
+                                                         BLOCK_SECTOR_SIZE),
+                                  &cnt);
+              chunk_size = (size > (int) (cnt * BLOCK_SECTOR_SIZE)
+                            ? (int) (cnt * BLOCK_SECTOR_SIZE)
+                            : size);
+              if (inode_write_bulk (dst, data, chunk_size, ofs) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
+              ofs += chunk_size;
               size -= chunk_size;
             }
 
           /* Finish up. */
-          file_close (dst);
+          inode_close (dst);
         }
     }
+  dir_close (dir.dir);
+  stream_close (&stream);
 
   /* Erase the ustar header from the start of the block device,
      so that the extraction operation is idempotent.  We erase
@@ -151,7 +370,6 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
   free (header);
 }
 
@@ -1,36 +1,106 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
+#include <stddef.h>
 #include <round.h>
 #include <string.h>
 #include <stdio.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/io.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Identifies an inode that maps its data with extents. */
+#define EXTENT_MAGIC 0x494e4f45
+
 #define NUM_DATA_BLOCKS 122
-#define PTRS_PER_BLOCK BLOCK_SECTOR_SIZE / sizeof(block_sector_t)
+#define PTRS_PER_BLOCK (BLOCK_SECTOR_SIZE / sizeof(block_sector_t))
+
+#define NUM_EXTENTS 61          /* Extents held in the inode itself. */
+#define EXTENTS_PER_BLOCK 63    /* Extents held in each overflow block. */
+
+#define INLINE_MAX 496          /* Most bytes of data held inline. */
+
+/* Most sectors of a file held back by delayed allocation, which
+   is also the longest run delay_flush() allocates at once. */
+#define DELAY_SECTORS 32
+#define DELAY_PAGES (DELAY_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE)
 
+/* Most bytes that one journal operation writes to a file, and to
+   a file that holds metadata, whose every sector is logged.  A
+   piece of a data file needs at most a few new index blocks. */
+#define WRITE_PIECE (128 * BLOCK_SECTOR_SIZE)
+#define META_PIECE (4 * BLOCK_SECTOR_SIZE)
+
+/* True if inode_create() should give new inodes the extent
+   layout.  Chosen at format time and persisted by the layout of
+   the root directory's inode. */
+bool inode_use_extents;
+
+/* A run of LENGTH consecutive data sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;
+    uint32_t length;
+  };
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   If IS_INLINE is true, the union holds the data itself, at most
+   INLINE_MAX bytes.  Otherwise MAGIC selects which half of the
+   union maps the data: one pointer per sector for INODE_MAGIC,
+   extents for EXTENT_MAGIC.  An inline inode keeps the MAGIC of
+   the layout it moves to once it grows past INLINE_MAX. */
 
 struct inode_disk {
   off_t length;
   block_sector_t parent_inode;
   bool is_dir;
-  block_sector_t data_blocks[NUM_DATA_BLOCKS];
-  block_sector_t primary_block;
-  block_sector_t secondary_block;
+  bool is_inline;
+  union {
+    uint8_t inline_data[INLINE_MAX];
+    struct {
+      block_sector_t data_blocks[NUM_DATA_BLOCKS];
+      block_sector_t primary_block;
+      block_sector_t secondary_block;
+    };
+    struct {
+      uint32_t extent_cnt;            /* Extents in use, overflow included. */
+      block_sector_t overflow_block;  /* First extent_block, or 0. */
+      struct extent extents[NUM_EXTENTS];
+    };
+  };
   unsigned magic;
 };
 
+/* Holds the extents past the first NUM_EXTENTS of an inode.
+   Overflow blocks form a chain starting at overflow_block. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next overflow block, or 0. */
+    uint32_t unused;
+    struct extent extents[EXTENTS_PER_BLOCK];
+  };
+
 bool inode_extend(struct inode_disk *disk_inode, 
               block_sector_t sector, 
               off_t length);
+static bool extent_extend (struct inode_disk *, block_sector_t, off_t,
+                           bool zero);
+static block_sector_t extent_byte_to_sector (const struct inode_disk *,
+                                             off_t pos);
+static void extent_release (struct inode_disk *);
+static void extent_get (const struct inode_disk *, size_t idx,
+                        struct extent *);
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -40,85 +110,540 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Returns true if the data of DISK_INODE, stored in SECTOR, is
+   file system metadata that goes through the journal: a
+   directory's entries or the free map. */
+static inline bool
+holds_metadata (const struct inode_disk *disk_inode, block_sector_t sector)
+{
+  return disk_inode->is_dir || sector == FREE_MAP_SECTOR;
+}
+
+/* In-memory inode.
+
+   HASH_ELEM, OPEN_CNT and REMOVED are protected by
+   open_inodes_lock.  RW protects DATA, DENY_WRITE_CNT and the
+   index maps: readers of the file hold it for reading, anything
+   that changes the length or allocates sectors holds it for
+   writing.  Because readers may load index maps concurrently,
+   MAP_LOCK additionally serializes that.  DIR_LOCK belongs to the
+   directory layer, which holds it while reading or changing a
+   directory's entries.  The delayed allocation window is
+   protected by RW like DATA; DELAY_ELEM, DIRTY and DIRTY_ELEM
+   also by writeback_lock. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
+    struct list_elem free_elem;         /* Element in free_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Guards data and length. */
+    struct lock map_lock;               /* Guards loading index maps. */
+    struct lock dir_lock;               /* Guards directory entries. */
     struct inode_disk data;             /* Inode content. */
+    bool dirty;                         /* DATA changed since written? */
+    struct list_elem dirty_elem;        /* In dirty_inodes if DIRTY. */
+
+    /* Index blocks read so far, loaded on first use by
+       block_map(), which also keeps them up to date. */
+    block_sector_t *primary_map;        /* Copy of primary_block. */
+    block_sector_t *secondary_map;      /* Copy of secondary_block. */
+    block_sector_t **secondary_maps;    /* Copies of its primary blocks. */
+
+    /* Delayed allocation window: data written into holes of a
+       block-mapped file, held in DELAY_BUF for the DELAY_CNT file
+       sectors starting at DELAY_START until delay_flush() gives
+       them disk sectors.  The sectors are reserved in the free
+       map meanwhile. */
+    uint8_t *delay_buf;                 /* DELAY_PAGES pages, or null. */
+    size_t delay_start;                 /* First file sector in window. */
+    size_t delay_cnt;                   /* Sectors in window. */
+    struct list_elem delay_elem;        /* In delayed_inodes if nonempty. */
   };
 
+static void inode_drop_index (struct inode *);
+static void mark_dirty (struct inode *);
+static void write_back (struct inode *);
+static block_sector_t block_goal (struct inode *, size_t index);
+static block_sector_t data_run (struct inode *, size_t index, size_t *cnt);
+static bool inode_grow (struct inode *, off_t length);
+static off_t inline_write (struct inode *, const void *, off_t size,
+                           off_t offset);
+static bool inline_promote (struct inode *);
+static off_t write_direct (struct inode *, const uint8_t *, off_t size,
+                           off_t offset);
+static off_t write_sectors (struct inode *, const uint8_t *, off_t size,
+                            off_t offset);
+static off_t write_pieces (struct inode *, const uint8_t *, off_t size,
+                           off_t offset, bool bulk);
+static void delay_read (struct inode *, size_t index, void *buffer,
+                        int ofs, int size);
+static bool delay_write (struct inode *, size_t index, const void *buffer,
+                         int ofs, int size);
+static void delay_flush (struct inode *);
+static void delay_discard (struct inode *);
+
 struct inode *inode_get_parent_inode(struct inode *node) {
-  return inode_open(node->data.parent_inode);
+  rwlock_acquire_read(&node->rw);
+  block_sector_t parent = node->data.parent_inode;
+  rwlock_release_read(&node->rw);
+  return inode_open(parent);
 }
 
 void inode_set_parent_inode(struct inode *node, block_sector_t p) {
+  journal_begin();
+  rwlock_acquire_write(&node->rw);
   node->data.parent_inode = p;
-  block_write(fs_device, node->sector, &node->data);
+  mark_dirty (node);
+  rwlock_release_write(&node->rw);
+  journal_end();
 }
 
 bool inode_isdir(struct inode *node) {
-  return node->data.is_dir;
+  rwlock_acquire_read(&node->rw);
+  bool is_dir = node->data.is_dir;
+  rwlock_release_read(&node->rw);
+  return is_dir;
 }
 
 void inode_set_isdir(struct inode *node, bool isdir) {
+  journal_begin();
+  rwlock_acquire_write(&node->rw);
   node->data.is_dir = isdir;
-  block_write(fs_device, node->sector, &node->data);
+  mark_dirty (node);
+  rwlock_release_write(&node->rw);
+  journal_end();
 }
 
 int inode_openers(struct inode *node) {
   return node->open_cnt;
 }
 
+/* Returns the contents of index block SECTOR, cached in *MAP.
+   The block is read through the buffer cache the first time and
+   kept in memory afterward.  If MAP is null or memory is short,
+   reads it into FALLBACK instead and returns that. */
+static const block_sector_t *
+index_block (block_sector_t **map, block_sector_t sector,
+             block_sector_t fallback[PTRS_PER_BLOCK])
+{
+  if (map == NULL)
+    {
+      cache_read (sector, fallback);
+      return fallback;
+    }
+  if (*map == NULL)
+    {
+      *map = malloc (BLOCK_SECTOR_SIZE);
+      if (*map == NULL)
+        {
+          cache_read (sector, fallback);
+          return fallback;
+        }
+      cache_read (sector, *map);
+    }
+  return *map;
+}
+
+/* Allocates a sector as close after GOAL as possible, zeroes it,
+   and stores it in *SECTORP.  META says whether the sector will
+   hold metadata.  Returns false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp, block_sector_t goal, bool meta)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate_near (1, goal, sectorp))
+    return false;
+  if (meta)
+    cache_write_meta (*sectorp, zeros);
+  else
+    cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns entry IDX of index block BLOCK, whose cached copy is
+   kept in *MAP.  A zero entry is a hole; if ALLOCATE is true,
+   fills it with a zeroed sector newly allocated near GOAL first,
+   which will hold metadata if META is true. */
+static block_sector_t
+map_entry (block_sector_t block, block_sector_t **map, size_t idx,
+           bool allocate, block_sector_t goal, bool meta)
+{
+  block_sector_t buffer[PTRS_PER_BLOCK];
+  block_sector_t sector = index_block (map, block, buffer)[idx];
+
+  if (sector == 0 && allocate && allocate_zeroed (&sector, goal, meta))
+    {
+      cache_write_meta_at (block, &sector, sizeof sector,
+                           idx * sizeof sector);
+      if (map != NULL && *map != NULL)
+        (*map)[idx] = sector;
+    }
+  return sector;
+}
+
+/* Returns where INODE caches the primary block at index IDX of
+   its secondary block, or a null pointer if memory is short. */
+static block_sector_t **
+secondary_slot (struct inode *inode, size_t idx)
+{
+  if (inode->secondary_maps == NULL)
+    inode->secondary_maps = calloc (PTRS_PER_BLOCK,
+                                    sizeof *inode->secondary_maps);
+  return inode->secondary_maps != NULL ? &inode->secondary_maps[idx] : NULL;
+}
+
+/* Returns the data sector for sector INDEX of block-mapped INODE,
+   or 0 if that part of the file is a hole.  If ALLOCATE is true,
+   allocates the data sector and any missing index blocks first,
+   returning 0 only if the disk is full. */
+static block_sector_t
+block_map (struct inode *inode, size_t index, bool allocate)
+{
+  struct inode_disk *d = &inode->data;
+  bool meta = holds_metadata (d, inode->sector);
+  block_sector_t goal = allocate ? block_goal (inode, index) : 0;
+  block_sector_t first;
+
+  if (index < NUM_DATA_BLOCKS)
+    {
+      if (d->data_blocks[index] == 0 && allocate
+          && allocate_zeroed (&d->data_blocks[index], goal, meta))
+        mark_dirty (inode);
+      return d->data_blocks[index];
+    }
+
+  index -= NUM_DATA_BLOCKS;
+  if (index < PTRS_PER_BLOCK)
+    {
+      if (d->primary_block == 0)
+        {
+          if (!allocate || !allocate_zeroed (&d->primary_block, goal, true))
+            return 0;
+          mark_dirty (inode);
+        }
+      return map_entry (d->primary_block, &inode->primary_map, index,
+                        allocate, goal, meta);
+    }
+
+  index -= PTRS_PER_BLOCK;
+  if (index < PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+    {
+      if (d->secondary_block == 0)
+        {
+          if (!allocate
+              || !allocate_zeroed (&d->secondary_block, goal, true))
+            return 0;
+          mark_dirty (inode);
+        }
+      first = map_entry (d->secondary_block, &inode->secondary_map,
+                         index / PTRS_PER_BLOCK, allocate, goal, true);
+      if (first == 0)
+        return 0;
+      return map_entry (first, secondary_slot (inode, index / PTRS_PER_BLOCK),
+                        index % PTRS_PER_BLOCK, allocate, goal, meta);
+    }
+  PANIC("FILE POS LARGER THAN MAX FILE SIZE");
+}
+
+/* Returns the sector that new sectors for sector INDEX of
+   block-mapped INODE should be allocated near: just past the data
+   sector before it, if that one is allocated, otherwise the
+   inode itself. */
+static block_sector_t
+block_goal (struct inode *inode, size_t index)
+{
+  block_sector_t prev = index > 0 ? block_map (inode, index - 1, false) : 0;
+  return prev != 0 ? prev + 1 : inode->sector;
+}
+
+/* Allocates any index blocks that block-mapped INODE lacks for
+   mapping sector INDEX, without allocating the data sector.
+   Returns false if the disk is full. */
+static bool
+block_map_index (struct inode *inode, size_t index)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t goal = block_goal (inode, index);
+
+  if (index < NUM_DATA_BLOCKS)
+    return true;
+
+  index -= NUM_DATA_BLOCKS;
+  if (index < PTRS_PER_BLOCK)
+    {
+      if (d->primary_block == 0)
+        {
+          if (!allocate_zeroed (&d->primary_block, goal, true))
+            return false;
+          mark_dirty (inode);
+        }
+      return true;
+    }
+
+  index -= PTRS_PER_BLOCK;
+  ASSERT (index < PTRS_PER_BLOCK * PTRS_PER_BLOCK);
+  if (d->secondary_block == 0)
+    {
+      if (!allocate_zeroed (&d->secondary_block, goal, true))
+        return false;
+      mark_dirty (inode);
+    }
+  return map_entry (d->secondary_block, &inode->secondary_map,
+                    index / PTRS_PER_BLOCK, true, goal, true) != 0;
+}
+
+/* Makes SECTOR the data sector for sector INDEX of block-mapped
+   INODE, which must be a hole whose index blocks
+   block_map_index() has already allocated. */
+static void
+block_install (struct inode *inode, size_t index, block_sector_t sector)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t block;
+  block_sector_t **map;
+  size_t idx;
+
+  if (index < NUM_DATA_BLOCKS)
+    {
+      ASSERT (d->data_blocks[index] == 0);
+      d->data_blocks[index] = sector;
+      mark_dirty (inode);
+      return;
+    }
+
+  index -= NUM_DATA_BLOCKS;
+  if (index < PTRS_PER_BLOCK)
+    {
+      block = d->primary_block;
+      map = &inode->primary_map;
+      idx = index;
+    }
+  else
+    {
+      index -= PTRS_PER_BLOCK;
+      block = map_entry (d->secondary_block, &inode->secondary_map,
+                         index / PTRS_PER_BLOCK, false, 0, true);
+      map = secondary_slot (inode, index / PTRS_PER_BLOCK);
+      idx = index % PTRS_PER_BLOCK;
+    }
+  ASSERT (block != 0);
+  cache_write_meta_at (block, &sector, sizeof sector, idx * sizeof sector);
+  if (map != NULL && *map != NULL)
+    (*map)[idx] = sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, and 0 if POS lies in a hole that reads as zeros. */
+
+static block_sector_t byte_to_sector (struct inode *inode, off_t pos) {
+  block_sector_t sector;
 
-static block_sector_t byte_to_sector (const struct inode *inode, off_t pos) {
   ASSERT (inode != NULL);
+  ASSERT (!inode->data.is_inline);
   if (pos >= inode->data.length)
     return -1;
-  int index = pos / BLOCK_SECTOR_SIZE;
-  if(index < NUM_DATA_BLOCKS) 
-    return inode->data.data_blocks[index];
-  else if(index < NUM_DATA_BLOCKS + 128){
-    block_sector_t buffer[128];
-    block_read(fs_device, inode->data.primary_block, &buffer);
-    block_sector_t s = buffer[index - NUM_DATA_BLOCKS];
-    return s;
-  } else if(index < NUM_DATA_BLOCKS + 128 + 128 * 128) {
-    block_sector_t buffer[128];
-    block_read(fs_device, inode->data.secondary_block, &buffer);
-    block_sector_t first = buffer[(index - NUM_DATA_BLOCKS - 128) / 128];
-    block_read(fs_device, first, &buffer);
-    block_sector_t s = buffer[(index - NUM_DATA_BLOCKS - 128) % 128];
-    return s;
-  }
-  PANIC("FILE POS LARGER THAN MAX FILE SIZE");
+  if (inode->data.magic == EXTENT_MAGIC)
+    return extent_byte_to_sector (&inode->data, pos);
+
+  // readers share RW, so loading index maps needs its own lock
+  lock_acquire (&inode->map_lock);
+  sector = block_map (inode, pos / BLOCK_SECTOR_SIZE, false);
+  lock_release (&inode->map_lock);
+  return sector;
+}
+
+/* Returns the sector holding byte POS of INODE, which must be
+   within the file, allocating it if it is a hole.
+   Returns 0 if the disk is full. */
+static block_sector_t
+allocate_sector (struct inode *inode, off_t pos)
+{
+  ASSERT (pos < inode->data.length);
+  if (inode->data.magic == EXTENT_MAGIC)
+    return extent_byte_to_sector (&inode->data, pos);
+  return block_map (inode, pos / BLOCK_SECTOR_SIZE, true);
+}
+
+/* Releases index block BLOCK, everything it points to, and so on
+   for LEVELS levels of indirection, to the free map. */
+static void
+release_index (block_sector_t block, int levels)
+{
+  block_sector_t entries[PTRS_PER_BLOCK];
+  size_t i;
+
+  if (levels > 0)
+    {
+      cache_read (block, entries);
+      for (i = 0; i < PTRS_PER_BLOCK; i++)
+        if (entries[i] != 0)
+          release_index (entries[i], levels - 1);
+    }
+  free_map_release (block, 1);
+}
+
+/* Releases every allocated data and index sector of block-mapped
+   DISK_INODE to the free map. */
+static void
+block_release (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < NUM_DATA_BLOCKS; i++)
+    if (disk_inode->data_blocks[i] != 0)
+      free_map_release (disk_inode->data_blocks[i], 1);
+  if (disk_inode->primary_block != 0)
+    release_index (disk_inode->primary_block, 1);
+  if (disk_inode->secondary_block != 0)
+    release_index (disk_inode->secondary_block, 2);
+}
+
+/* Frees INODE's cached index blocks. */
+static void
+inode_drop_index (struct inode *inode)
+{
+  size_t i;
+
+  free (inode->primary_map);
+  free (inode->secondary_map);
+  if (inode->secondary_maps != NULL)
+    {
+      for (i = 0; i < 128; i++)
+        free (inode->secondary_maps[i]);
+      free (inode->secondary_maps);
+    }
+  inode->primary_map = NULL;
+  inode->secondary_map = NULL;
+  inode->secondary_maps = NULL;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes, free_inodes, the statistics below, and
+   each open inode's OPEN_CNT and REMOVED. */
+static struct lock open_inodes_lock;
+
+/* Unused `struct inode's.  They are carved out of whole pages
+   and never returned to the page allocator, which packs them
+   more tightly than malloc()'s power-of-two blocks and makes
+   opening and closing an inode a list operation. */
+static struct list free_inodes;
+
+/* Statistics. */
+static unsigned long long open_calls;   /* Calls to inode_open(). */
+static unsigned long long reopen_cnt;   /* ...that found it open. */
+static uint64_t lookup_cycles;          /* ...spent searching the table. */
+static size_t slab_cnt;                 /* Objects carved so far. */
+
+/* Open inodes with a nonempty delayed allocation window, so that
+   inode_flush_all() can find them. */
+static struct list delayed_inodes;
+
+/* Open inodes whose DATA has changed since it was last written to
+   the buffer cache, for inode_write_dirty(). */
+static struct list dirty_inodes;
+
+/* Protects delayed_inodes, dirty_inodes and the statistics
+   below.  Acquired after open_inodes_lock and any inode's RW. */
+static struct lock writeback_lock;
+
+/* Write-back statistics. */
+static unsigned long long delayed_cnt;  /* Sectors allocated late. */
+static unsigned long long run_cnt;      /* ...in this many runs. */
+static unsigned long long change_cnt;   /* Calls to mark_dirty(). */
+static unsigned long long write_cnt;    /* Inodes written back. */
+
+static unsigned inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  list_init (&free_inodes);
+  lock_init (&open_inodes_lock);
+  list_init (&delayed_inodes);
+  list_init (&dirty_inodes);
+  lock_init (&writeback_lock);
+}
+
+/* Returns the hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+/* Returns true if the inode containing A has a lower sector than
+   the one containing B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
+
+/* Returns an unused `struct inode', carving a new page into
+   inodes if none is left.  Returns a null pointer if memory is
+   exhausted. */
+static struct inode *
+inode_alloc (void)
+{
+  if (list_empty (&free_inodes))
+    {
+      struct inode *page = palloc_get_page (0);
+      size_t i;
+
+      if (page == NULL)
+        return NULL;
+      for (i = 0; i < PGSIZE / sizeof *page; i++)
+        list_push_back (&free_inodes, &page[i].free_elem);
+      slab_cnt += PGSIZE / sizeof *page;
+    }
+  return list_entry (list_pop_front (&free_inodes), struct inode, free_elem);
+}
+
+/* Returns INODE to the unused inodes. */
+static void
+inode_free (struct inode *inode)
+{
+  list_push_front (&free_inodes, &inode->free_elem);
+}
+
+/* Prints open inode table statistics. */
+void
+inode_print_stats (void)
+{
+  printf ("Inodes: %llu opens, %llu already open, %zu open now, "
+          "%zu allocated\n",
+          open_calls, reopen_cnt, hash_size (&open_inodes), slab_cnt);
+  printf ("Open inode lookup: %llu cycles on average\n",
+          open_calls > 0 ? lookup_cycles / open_calls : 0);
+  printf ("Delayed allocation: %llu sectors in %llu runs\n",
+          delayed_cnt, run_cnt);
+  printf ("Inode write-back: %llu changes, %llu writes\n",
+          change_cnt, write_cnt);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  IS_DIR says whether it is a directory.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
 
@@ -128,99 +653,38 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-  // free_map_allocate each sector separately
-  // allocate primary and secondary levels correctly
+  // block-mapped inodes start out as one big hole, and small
+  // files and directories keep their zeroed data inline
   disk_inode = calloc (1, sizeof *disk_inode);
   if(!disk_inode)
     return false;
   disk_inode->length = 0;
-  disk_inode->magic = INODE_MAGIC;
-  bool success = inode_extend(disk_inode, sector, length);
+  disk_inode->is_dir = is_dir;
+  disk_inode->magic = inode_use_extents ? EXTENT_MAGIC : INODE_MAGIC;
+  bool success = true;
+  if (length <= INLINE_MAX) {
+    disk_inode->is_inline = true;
+    disk_inode->length = length;
+  } else
+    success = inode_extend(disk_inode, sector, length);
+  cache_write_meta (sector, disk_inode);
   free(disk_inode);
   return success;
 }
 
+// Grows DISK_INODE, stored in SECTOR, to LENGTH bytes.  The caller writes
+// DISK_INODE back afterward, even on failure.
 bool 
 inode_extend(struct inode_disk *disk_inode, 
               block_sector_t sector, 
               off_t length) {
-  // estend it
-  static char zeros[BLOCK_SECTOR_SIZE];
-  size_t sectors = bytes_to_sectors (length);
-  size_t current_sectors = bytes_to_sectors (disk_inode->length);
-  size_t i;
-  block_sector_t *primary_data = calloc(128, sizeof(block_sector_t));
-  block_sector_t *secondary_primary = calloc(128, sizeof(block_sector_t));
-  block_sector_t **secondary_primary_data = calloc(128, sizeof(block_sector_t *));
-  for (i = 0; NUM_DATA_BLOCKS + 128 + 128*i < sectors; i++) {
-    secondary_primary_data[i] = calloc(128, sizeof(block_sector_t));
-  }
-
-  // copy everything from the current inode into the temporarruasd h
-  if(disk_inode->primary_block)
-    block_read (fs_device, disk_inode->primary_block, primary_data);
-  if(disk_inode->secondary_block){
-    block_read (fs_device, disk_inode->secondary_block, secondary_primary);
-    for(i = 0; i < 128 && secondary_primary[i]; i++){
-      block_read(fs_device, secondary_primary[i], secondary_primary_data[i]);
-    }
-  }
-  for(i = current_sectors; i < sectors; i++) {
-    if(i < NUM_DATA_BLOCKS) {
-      // data blocks
-      if (!free_map_allocate (1, &disk_inode->data_blocks[i])) return false;
-      block_write (fs_device, disk_inode->data_blocks[i], &zeros);
-    } else if(i < NUM_DATA_BLOCKS + 128) {
-      // primary block
-      if(i == NUM_DATA_BLOCKS){
-        // the block itself
-        if (!free_map_allocate (1, &disk_inode->primary_block)) return false;
-        block_write (fs_device, disk_inode->primary_block, &zeros);
-      }
-      // the data
-      if (!free_map_allocate (1, &primary_data[i-NUM_DATA_BLOCKS])) return false;
-      block_write (fs_device, primary_data[i-NUM_DATA_BLOCKS], &zeros);
-    } else if(i < NUM_DATA_BLOCKS + 128 + 128 * 128) {
-      int second_index = i - (NUM_DATA_BLOCKS + 128);
-      // secondary block
-      if(second_index == 0){
-        // the block itself
-        if (!free_map_allocate (1, &disk_inode->secondary_block)) return false;
-        block_write (fs_device, disk_inode->secondary_block, &zeros);
-      }
-      if(second_index % 128 == 0){
-        // a primary block itself
-        if (!free_map_allocate (1, &secondary_primary[second_index / 128])) return false;
-        block_write (fs_device, secondary_primary[second_index / 128], &zeros);
-      }
-      // the data
-      if (!free_map_allocate (1, &secondary_primary_data[second_index / 128][second_index % 128])) return false;
-      block_write (fs_device, secondary_primary_data[second_index / 128][second_index % 128], &zeros);
-    }
-  }
-
-  disk_inode->length = length;
-
-  block_write (fs_device, sector, disk_inode);
-  // write primary block
-  if (sectors > NUM_DATA_BLOCKS && current_sectors < NUM_DATA_BLOCKS + 128)
-    block_write (fs_device, disk_inode->primary_block, primary_data);
-  // write secondary block
-  if (sectors > NUM_DATA_BLOCKS + 128) {
-    block_write (fs_device, disk_inode->secondary_block, secondary_primary);
-    // write each secondary primary data array to each primary block
-    for(i = 0; i < 128 && secondary_primary[i]; i++){
-      block_write (fs_device, secondary_primary[i], secondary_primary_data[i]);
-    }
-  }
-
-  for (i = 0; NUM_DATA_BLOCKS + 128 + 128*i < sectors; i++) {
-    free(secondary_primary_data[i]);
-  }
-  free(primary_data);
-  free(secondary_primary);
-  free(secondary_primary_data);
-  
+  if (disk_inode->magic == EXTENT_MAGIC)
+    return extent_extend (disk_inode, sector, length, true);
+
+  // data sectors are allocated when first written, so growing
+  // a block-mapped file only leaves a hole past the old end
+  if (length > disk_inode->length)
+    disk_inode->length = length;
   return true;
 }
 
@@ -230,33 +694,56 @@ inode_extend(struct inode_disk *disk_inode,
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
+  uint64_t start;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Allocate memory.  The new inode doubles as the lookup key. */
+  lock_acquire (&open_inodes_lock);
+  inode = inode_alloc ();
+  if (inode == NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      lock_release (&open_inodes_lock);
+      return NULL;
     }
+  inode->sector = sector;
+  open_calls++;
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  /* Check whether this inode is already open. */
+  start = rdtsc ();
+  e = hash_insert (&open_inodes, &inode->hash_elem);
+  lookup_cycles += rdtsc () - start;
+  if (e != NULL)
+    {
+      inode_free (inode);
+      reopen_cnt++;
+      inode = hash_entry (e, struct inode, hash_elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
+  /* Initialize.  Other openers can find the inode as soon as
+     OPEN_INODES_LOCK is released, so RW is held for writing until
+     DATA has been read. */
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->primary_map = NULL;
+  inode->secondary_map = NULL;
+  inode->secondary_maps = NULL;
+  inode->delay_buf = NULL;
+  inode->delay_start = 0;
+  inode->delay_cnt = 0;
+  inode->dirty = false;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->map_lock);
+  lock_init (&inode->dir_lock);
+  rwlock_acquire_write (&inode->rw);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+  rwlock_release_write (&inode->rw);
   return inode;
 }
 
@@ -265,7 +752,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -286,49 +777,56 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* The last opener allocates any data still in the delayed
+     allocation window and writes INODE back while it is in the
+     inode table, so that an inode_open() meanwhile finds it
+     instead of reading a stale inode, or sectors that don't hold
+     the data yet, from disk.  Inline data exists nowhere else.
+     Such an opener may write more, so this repeats until INODE is
+     clean; it then closes INODE in turn if it is still open. */
+  lock_acquire (&open_inodes_lock);
+  while (inode->open_cnt == 1 && !inode->removed
+         && (inode->delay_cnt > 0 || inode->dirty))
+    {
+      lock_release (&open_inodes_lock);
+      inode_flush (inode);
+      lock_acquire (&open_inodes_lock);
+    }
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (--inode->open_cnt > 0)
+    {
+      lock_release (&open_inodes_lock);
+      return;
+    }
+
+  /* Remove from inode table and release lock.  Nobody else can
+     reach INODE after this; inode_flush_all() skips it because
+     its OPEN_CNT is 0. */
+  hash_delete (&open_inodes, &inode->hash_elem);
+  lock_release (&open_inodes_lock);
+
+  /* Deallocate blocks if removed.  Either way INODE is clean, but
+     it may still be on dirty_inodes. */
+  if (inode->removed) 
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      delay_discard (inode);
+      free_map_release (inode->sector, 1);
+      if (inode->data.is_inline)
         {
-          free_map_release (inode->sector, 1);
-          size_t sectors = bytes_to_sectors(inode->data.length);
-          if (sectors > 0) {
-            size_t i;
-            for (i = 0; i < sectors && i < NUM_DATA_BLOCKS; i++) {
-              free_map_release(inode->data.data_blocks[i], 1);
-            }
-            if (sectors > NUM_DATA_BLOCKS) {
-              free_map_release(inode->data.primary_block, 1);
-              block_sector_t primary_data[128];
-              block_read(fs_device, inode->data.primary_block, &primary_data);
-              for (i = 0; !primary_data[i]; i++) {
-                free_map_release(primary_data[i], 1);
-              }
-            }
-            if (sectors > NUM_DATA_BLOCKS + 128) {
-              free_map_release(inode->data.secondary_block, 1);
-              block_sector_t secondary_data[128];
-              block_read(fs_device, inode->data.secondary_block, &secondary_data);
-              for (i = 0; !secondary_data[i]; i++) {
-                free_map_release(secondary_data[i], 1);
-                block_sector_t data[128];
-                block_read(fs_device, secondary_data[i], &data);
-                int j;
-                for (j = 0; !data[i]; j++) {
-                  free_map_release(data[i], 1);
-                }
-              }
-            }
-          }
+          /* Inline data has no sectors of its own. */
         }
-
-      free (inode); 
+      else if (inode->data.magic == EXTENT_MAGIC)
+        extent_release (&inode->data);
+      else
+        block_release (&inode->data);
     }
+  write_back (inode);
+
+  inode_drop_index (inode);
+  lock_acquire (&open_inodes_lock);
+  inode_free (inode);
+  lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -337,7 +835,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -348,8 +848,19 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.is_inline)
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (size < bytes_read)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      size = 0;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -360,7 +871,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -369,65 +880,290 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
-      
+      if (sector_idx == 0)
+        delay_read (inode, offset / BLOCK_SECTOR_SIZE, buffer + bytes_read,
+                    sector_ofs, chunk_size);
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+                       sector_ofs);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
+/* Queues the sectors holding SIZE bytes of INODE starting at
+   OFFSET to be read into the buffer cache in the background.
+   Bytes past end of file are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rw);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  if (inode->data.is_inline)
+    end = 0;                    /* Read along with the inode. */
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx == (block_sector_t) -1)
+        break;
+      if (sector_idx != 0)
+        cache_read_ahead (sector_idx);
+    }
+  rwlock_release_read (&inode->rw);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
    (Normally a write at end of file would extend the inode, but
    growth is not yet implemented.) */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
+  return write_pieces (inode, buffer, size, offset, false);
+}
+
+/* Gives the first LENGTH bytes of INODE, an empty ordinary file,
+   disk sectors in as few runs as the free map allows, so that
+   the caller can fill it with inode_write_bulk() instead of
+   growing it a write at a time.  Unlike growing the file, this
+   does not zero the sectors: they hold whatever was on disk
+   until they are written.  Files that fit inline are left alone.
+   Returns false if the disk is full, after which the caller
+   should remove the file. */
+bool
+inode_preallocate (struct inode *inode, off_t length)
+{
+  struct inode_disk *d = &inode->data;
+  bool success = true;
+
+  if (length <= INLINE_MAX)
+    return true;
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rw);
+  ASSERT (!holds_metadata (d, inode->sector));
+  ASSERT (d->is_inline && d->length == 0);
+  d->is_inline = false;
+  if (d->magic == EXTENT_MAGIC)
+    success = extent_extend (d, inode->sector, length, false);
+  else
+    {
+      size_t cnt = bytes_to_sectors (length);
+      size_t done = 0;
+
+      while (success && done < cnt)
+        {
+          size_t run = cnt - done;
+          block_sector_t start;
+          size_t i;
+
+          /* Index blocks land just past each run. */
+          while (!free_map_allocate_near (run, block_goal (inode, done),
+                                          &start))
+            if ((run /= 2) == 0)
+              break;
+          success = run > 0;
+          for (i = 0; i < run; i++)
+            {
+              if (!block_map_index (inode, done + i))
+                {
+                  free_map_release (start + i, run - i);
+                  success = false;
+                  break;
+                }
+              block_install (inode, done + i, start + i);
+            }
+          done += i;
+        }
+      if (success)
+        d->length = length;
+    }
+  mark_dirty (inode);
+  rwlock_release_write (&inode->rw);
+  journal_end ();
+
+  return success;
+}
+
+/* Like inode_write_at(), but for filling a file laid out by
+   inode_preallocate() with large writes: whole sectors that
+   already have disk sectors are written around the buffer cache,
+   several at a time, and a write that reaches end of file zeroes
+   the rest of its last sector. */
+off_t
+inode_write_bulk (struct inode *inode, const void *buffer, off_t size,
+                  off_t offset)
+{
+  return write_pieces (inode, buffer, size, offset, true);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   for inode_write_at(), or for inode_write_bulk() if BULK is
+   true.  Each piece of up to WRITE_PIECE bytes, or META_PIECE
+   bytes in a file that holds metadata, is a journal operation of
+   its own, so that journal_begin() can commit the running
+   transaction between pieces once it reaches its limit instead
+   of one large write outgrowing the log or the buffer cache.
+   Returns the number of bytes written. */
+static off_t
+write_pieces (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset, bool bulk)
+{
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  while (bytes_written < size)
+    {
+      off_t pos = offset + bytes_written;
+      off_t piece = size - bytes_written;
+      off_t written = 0;
+      off_t max;
+      bool meta;
+
+      journal_begin ();
+      rwlock_acquire_write (&inode->rw);
+      meta = holds_metadata (&inode->data, inode->sector);
+      max = meta ? META_PIECE : WRITE_PIECE;
+      if (piece > max - pos % max)
+        piece = max - pos % max;
+      if (inode->deny_write_cnt == 0 && inode_grow (inode, pos + piece))
+        {
+          if (inode->data.is_inline)
+            written = inline_write (inode, buffer + bytes_written, piece,
+                                    pos);
+          else
+            {
+              if (bulk && !meta)
+                written = write_direct (inode, buffer + bytes_written,
+                                        piece, pos);
+              written += write_sectors (inode,
+                                        buffer + bytes_written + written,
+                                        piece - written, pos + written);
+            }
+        }
+      rwlock_release_write (&inode->rw);
+      journal_end ();
+
+      bytes_written += written;
+      if (written < piece)
+        break;
+    }
+  return bytes_written;
+}
+
+/* Makes INODE at least LENGTH bytes long if it is shorter, first
+   moving its data out of line if LENGTH no longer fits inline.
+   Returns false if the disk is full.  INODE's RW must be held
+   for writing. */
+static bool
+inode_grow (struct inode *inode, off_t length)
+{
+  if (inode->data.is_inline && length > INLINE_MAX
+      && !inline_promote (inode))
+    return false;
+  if (inode->data.is_inline)
+    return true;
 
   // extend if needed
-  if(byte_to_sector (inode, offset + size) == -1) {
-    if(!inode_extend(&inode->data, inode->sector, offset + size))
-      return 0;
-  }
+  if (byte_to_sector (inode, length) == (block_sector_t) -1)
+    {
+      bool success = inode_extend (&inode->data, inode->sector, length);
+      mark_dirty (inode);
+      return success;
+    }
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into inline INODE at OFFSET,
+   which must fit within INLINE_MAX bytes.  Returns SIZE. */
+static off_t
+inline_write (struct inode *inode, const void *buffer, off_t size,
+              off_t offset)
+{
+  struct inode_disk *d = &inode->data;
+
+  ASSERT (offset + size <= INLINE_MAX);
+  memcpy (d->inline_data + offset, buffer, size);
+  if (offset + size > d->length)
+    d->length = offset + size;
+  mark_dirty (inode);
+  return size;
+}
+
+/* Moves inline INODE's data into sectors of its own, laid out as
+   its MAGIC says.  Returns false, leaving INODE inline, if the
+   disk is full or memory is short.  INODE's RW must be held for
+   writing. */
+static bool
+inline_promote (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  off_t length = d->length;
+  uint8_t *copy;
+
+  copy = malloc (INLINE_MAX);
+  if (copy == NULL)
+    return false;
+  memcpy (copy, d->inline_data, INLINE_MAX);
+  memset (d->inline_data, 0, INLINE_MAX);
+  d->is_inline = false;
+  d->length = 0;
+
+  mark_dirty (inode);
+  if (!inode_extend (d, inode->sector, length)
+      || write_sectors (inode, copy, length, 0) != length)
+    {
+      /* Give back whatever was allocated and go back inline. */
+      if (d->magic == EXTENT_MAGIC)
+        extent_release (d);
+      else
+        {
+          delay_discard (inode);
+          block_release (d);
+          inode_drop_index (inode);
+        }
+      memcpy (d->inline_data, copy, INLINE_MAX);
+      d->is_inline = true;
+      d->length = length;
+      mark_dirty (inode);
+      free (copy);
+      return false;
+    }
+  free (copy);
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into the sectors of INODE, which
+   must not be inline and must already be at least OFFSET + SIZE
+   bytes long, starting at OFFSET.  Returns the number of bytes
+   written, which is less than SIZE only if the disk is full.
+   INODE's RW must be held for writing. */
+static off_t
+write_sectors (struct inode *inode, const uint8_t *buffer, off_t size,
+               off_t offset)
+{
+  off_t bytes_written = 0;
+  bool meta = holds_metadata (&inode->data, inode->sector);
+  bool delayed = !meta && inode->data.magic == INODE_MAGIC;
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Starting byte offset within sector. */
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -436,30 +1172,24 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+      /* Holes in ordinary files get their sectors later, a run at
+         a time, unless the window can't take the data. */
+      bool buffered = (delayed && byte_to_sector (inode, offset) == 0
+                       && delay_write (inode, offset / BLOCK_SECTOR_SIZE,
+                                       buffer + bytes_written, sector_ofs,
+                                       chunk_size));
+      if (!buffered)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+          /* Sector to write. */
+          block_sector_t sector_idx = allocate_sector (inode, offset);
+          if (sector_idx == 0)
+            break;
+          if (meta)
+            cache_write_meta_at (sector_idx, buffer + bytes_written,
+                                 chunk_size, sector_ofs);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+            cache_write_at (sector_idx, buffer + bytes_written, chunk_size,
+                            sector_ofs);
         }
 
       /* Advance. */
@@ -467,18 +1197,102 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
   return bytes_written;
 }
 
+/* Writes as much of the SIZE bytes from BUFFER as falls in whole
+   sectors of INODE that already have disk sectors, starting at
+   OFFSET and stopping at the first that has none, with
+   cache_write_multiple().  If the write ends at end of file, its
+   partial last sector counts as whole, padded with zeros.
+   Returns the number of bytes written, possibly 0.  INODE must
+   not be inline, and its RW must be held for writing. */
+static off_t
+write_direct (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset)
+{
+  off_t bytes_written = 0;
+
+  if (offset % BLOCK_SECTOR_SIZE != 0)
+    return 0;
+  while (bytes_written < size)
+    {
+      off_t left = size - bytes_written;
+      size_t index = (offset + bytes_written) / BLOCK_SECTOR_SIZE;
+      size_t cnt = left / BLOCK_SECTOR_SIZE;
+      block_sector_t start;
+
+      if (cnt == 0)
+        {
+          uint8_t tail[BLOCK_SECTOR_SIZE];
+
+          cnt = 1;
+          if (offset + size < inode->data.length
+              || (start = data_run (inode, index, &cnt)) == 0)
+            break;
+          memcpy (tail, buffer + bytes_written, left);
+          memset (tail + left, 0, BLOCK_SECTOR_SIZE - left);
+          cache_write (start, tail);
+          bytes_written += left;
+          break;
+        }
+
+      start = data_run (inode, index, &cnt);
+      if (start == 0)
+        break;
+      cache_write_multiple (start, cnt, buffer + bytes_written);
+      bytes_written += cnt * BLOCK_SECTOR_SIZE;
+    }
+  return bytes_written;
+}
+
+/* Returns the disk sector holding file sector INDEX of INODE, or
+   0 if it has none, and reduces *CNT to the number of file
+   sectors from INDEX on, at most *CNT, that also follow one
+   another on disk.  INODE must not be inline, and its RW must be
+   held for writing. */
+static block_sector_t
+data_run (struct inode *inode, size_t index, size_t *cnt)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t start;
+  size_t i;
+
+  if (d->magic == EXTENT_MAGIC)
+    {
+      for (i = 0; i < d->extent_cnt; i++)
+        {
+          struct extent e;
+          extent_get (d, i, &e);
+          if (index < e.length)
+            {
+              if (*cnt > e.length - index)
+                *cnt = e.length - index;
+              return e.start + index;
+            }
+          index -= e.length;
+        }
+      return 0;
+    }
+
+  start = block_map (inode, index, false);
+  for (i = 1; start != 0 && i < *cnt; i++)
+    if (block_map (inode, index + i, false) != start + i)
+      break;
+  *cnt = i;
+  return start;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -487,14 +1301,522 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
+  /* A single aligned load, so it needs no lock: callers get the
+     length either before or after a concurrent extension. */
   return inode->data.length;
 }
+
+/* Acquires the lock that serializes access to the entries of
+   directory INODE. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock taken by inode_lock_dir(). */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns true if INODE maps its data with extents. */
+bool
+inode_has_extents (const struct inode *inode)
+{
+  return inode->data.magic == EXTENT_MAGIC;
+}
+
+/* Extent layout. */
+
+/* Returns the sector of the overflow block holding extent IDX of
+   DISK_INODE, which must be at least NUM_EXTENTS, and stores the
+   extent's index within that block in *SLOT.  Returns 0 if the
+   chain does not reach that far. */
+static block_sector_t
+overflow_block (const struct inode_disk *disk_inode, size_t idx,
+                size_t *slot)
+{
+  block_sector_t block = disk_inode->overflow_block;
+  size_t skip;
+
+  ASSERT (idx >= NUM_EXTENTS);
+  idx -= NUM_EXTENTS;
+  for (skip = idx / EXTENTS_PER_BLOCK; skip > 0 && block != 0; skip--)
+    cache_read_at (block, &block, sizeof block,
+                   offsetof (struct extent_block, next));
+  *slot = idx % EXTENTS_PER_BLOCK;
+  return block;
+}
+
+/* Stores extent IDX of DISK_INODE into *E. */
+static void
+extent_get (const struct inode_disk *disk_inode, size_t idx,
+            struct extent *e)
+{
+  block_sector_t block;
+  size_t slot;
+
+  ASSERT (idx < disk_inode->extent_cnt);
+  if (idx < NUM_EXTENTS)
+    {
+      *e = disk_inode->extents[idx];
+      return;
+    }
+  block = overflow_block (disk_inode, idx, &slot);
+  ASSERT (block != 0);
+  cache_read_at (block, e, sizeof *e,
+                 offsetof (struct extent_block, extents[slot]));
+}
+
+/* Stores E as extent IDX of DISK_INODE, which must be an
+   existing extent or the one just past the last.  Allocates an
+   overflow block if needed.  Returns false if that fails. */
+static bool
+extent_put (struct inode_disk *disk_inode, size_t idx,
+            const struct extent *e)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t block;
+  size_t slot;
+
+  ASSERT (idx <= disk_inode->extent_cnt);
+  if (idx < NUM_EXTENTS)
+    {
+      disk_inode->extents[idx] = *e;
+      return true;
+    }
+
+  block = overflow_block (disk_inode, idx, &slot);
+  if (block == 0 || slot == 0)
+    {
+      /* Extent IDX starts a new overflow block, which is linked
+         from the inode or from the last block of the chain. */
+      block_sector_t new_block;
+      if (!free_map_allocate_near (1, e->start, &new_block))
+        return false;
+      cache_write_meta (new_block, zeros);
+      if (idx == NUM_EXTENTS)
+        disk_inode->overflow_block = new_block;
+      else
+        {
+          size_t last_slot;
+          block_sector_t last = overflow_block (disk_inode, idx - 1,
+                                                &last_slot);
+          cache_write_meta_at (last, &new_block, sizeof new_block,
+                               offsetof (struct extent_block, next));
+        }
+      block = new_block;
+    }
+  cache_write_meta_at (block, e, sizeof *e,
+                       offsetof (struct extent_block, extents[slot]));
+  return true;
+}
+
+/* Returns the data sector holding byte POS of extent-mapped
+   DISK_INODE, or -1 if no sector has been allocated for it. */
+static block_sector_t
+extent_byte_to_sector (const struct inode_disk *disk_inode, off_t pos)
+{
+  size_t index = pos / BLOCK_SECTOR_SIZE;
+  size_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    {
+      struct extent e;
+      extent_get (disk_inode, i, &e);
+      if (index < e.length)
+        return e.start + index;
+      index -= e.length;
+    }
+  return -1;
+}
+
+/* Grows extent-mapped DISK_INODE, stored in SECTOR, to LENGTH
+   bytes.  New sectors are allocated in runs as long as the free
+   map allows, and a run that continues the last extent is
+   merged into it.  They are zeroed if ZERO is true; otherwise
+   they hold stale data until the caller overwrites them.
+   Sectors allocated before a failure
+   stay attached to the inode and are reused by the next
+   extension, so the caller must write DISK_INODE back either
+   way. */
+static bool
+extent_extend (struct inode_disk *disk_inode, block_sector_t sector,
+               off_t length, bool zero)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t sectors = bytes_to_sectors (length);
+  size_t allocated = 0;
+  struct extent last = {0, 0};
+  bool meta = holds_metadata (disk_inode, sector);
+  bool success = true;
+  size_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    {
+      extent_get (disk_inode, i, &last);
+      allocated += last.length;
+    }
+
+  while (allocated < sectors)
+    {
+      size_t cnt = sectors - allocated;
+      block_sector_t goal = (disk_inode->extent_cnt > 0
+                             ? last.start + last.length : sector);
+      block_sector_t start;
+
+      /* Try to continue the last extent, or start near the inode. */
+      while (!free_map_allocate_near (cnt, goal, &start))
+        if ((cnt /= 2) == 0)
+          break;
+      if (cnt == 0)
+        {
+          success = false;
+          break;
+        }
+      for (i = 0; zero && i < cnt; i++)
+        if (meta)
+          cache_write_meta (start + i, zeros);
+        else
+          cache_write (start + i, zeros);
+
+      if (disk_inode->extent_cnt > 0 && last.start + last.length == start)
+        {
+          last.length += cnt;
+          extent_put (disk_inode, disk_inode->extent_cnt - 1, &last);
+        }
+      else
+        {
+          last.start = start;
+          last.length = cnt;
+          if (!extent_put (disk_inode, disk_inode->extent_cnt, &last))
+            {
+              free_map_release (start, cnt);
+              success = false;
+              break;
+            }
+          disk_inode->extent_cnt++;
+        }
+      allocated += cnt;
+    }
+
+  if (success && length > disk_inode->length)
+    disk_inode->length = length;
+  return success;
+}
+
+/* Releases every data sector and overflow block of extent-mapped
+   DISK_INODE to the free map. */
+static void
+extent_release (struct inode_disk *disk_inode)
+{
+  block_sector_t block = disk_inode->overflow_block;
+  size_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    {
+      struct extent e;
+      extent_get (disk_inode, i, &e);
+      free_map_release (e.start, e.length);
+    }
+  while (block != 0)
+    {
+      block_sector_t next;
+      cache_read_at (block, &next, sizeof next,
+                     offsetof (struct extent_block, next));
+      free_map_release (block, 1);
+      block = next;
+    }
+}
+
+/* Delayed allocation. */
+
+/* Copies SIZE bytes at offset OFS of file sector INDEX of INODE,
+   a hole on disk, into BUFFER.  They come from the delayed
+   allocation window if it holds that sector, otherwise they are
+   zeros. */
+static void
+delay_read (struct inode *inode, size_t index, void *buffer, int ofs,
+            int size)
+{
+  if (inode->delay_cnt > 0 && index >= inode->delay_start
+      && index < inode->delay_start + inode->delay_cnt)
+    memcpy (buffer, inode->delay_buf
+                    + (index - inode->delay_start) * BLOCK_SECTOR_SIZE + ofs,
+            size);
+  else
+    memset (buffer, 0, size);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS of file sector
+   INDEX of block-mapped INODE, a hole on disk, keeping them in
+   INODE's delayed allocation window.  The window only grows at
+   its end, so a write elsewhere first flushes it.  Returns false
+   if the sector can't be delayed because the disk is full or
+   memory is short, in which case the caller should allocate it
+   right away.  INODE's RW must be held for writing. */
+static bool
+delay_write (struct inode *inode, size_t index, const void *buffer,
+             int ofs, int size)
+{
+  size_t end = inode->delay_start + inode->delay_cnt;
+
+  if (inode->delay_cnt > 0
+      && (index < inode->delay_start || index > end
+          || (index == end && inode->delay_cnt == DELAY_SECTORS)))
+    delay_flush (inode);
+
+  if (inode->delay_cnt == 0 || index == inode->delay_start + inode->delay_cnt)
+    {
+      /* Add sector INDEX to the window.  Its index blocks are
+         allocated now so that delay_flush() can't fail. */
+      if (!block_map_index (inode, index) || !free_map_reserve (1))
+        return false;
+      if (inode->delay_cnt == 0)
+        {
+          inode->delay_buf = palloc_get_multiple (0, DELAY_PAGES);
+          if (inode->delay_buf == NULL)
+            {
+              free_map_unreserve (1);
+              return false;
+            }
+          inode->delay_start = index;
+          lock_acquire (&writeback_lock);
+          list_push_back (&delayed_inodes, &inode->delay_elem);
+          lock_release (&writeback_lock);
+        }
+      memset (inode->delay_buf + inode->delay_cnt * BLOCK_SECTOR_SIZE, 0,
+              BLOCK_SECTOR_SIZE);
+      inode->delay_cnt++;
+    }
+
+  memcpy (inode->delay_buf
+          + (index - inode->delay_start) * BLOCK_SECTOR_SIZE + ofs,
+          buffer, size);
+  return true;
+}
+
+/* Empties INODE's delayed allocation window, freeing its buffer
+   and giving back its reservation. */
+static void
+delay_discard (struct inode *inode)
+{
+  if (inode->delay_cnt > 0)
+    {
+      free_map_unreserve (inode->delay_cnt);
+      lock_acquire (&writeback_lock);
+      list_remove (&inode->delay_elem);
+      lock_release (&writeback_lock);
+      inode->delay_cnt = 0;
+    }
+  palloc_free_multiple (inode->delay_buf, DELAY_PAGES);
+  inode->delay_buf = NULL;
+}
+
+/* Gives the sectors in INODE's delayed allocation window disk
+   sectors, in as few runs as the free map allows, and writes
+   their data into the buffer cache.  INODE's RW must be held for
+   writing, or nobody else may be able to reach INODE. */
+static void
+delay_flush (struct inode *inode)
+{
+  size_t done = 0;
+  size_t runs = 0;
+  block_sector_t goal = block_goal (inode, inode->delay_start);
+
+  while (done < inode->delay_cnt)
+    {
+      size_t cnt = inode->delay_cnt - done;
+      block_sector_t start;
+      size_t i;
+
+      /* A single reserved sector is always free. */
+      while (!free_map_claim (cnt, goal, &start))
+        {
+          ASSERT (cnt > 1);
+          cnt /= 2;
+        }
+      goal = start + cnt;
+      for (i = 0; i < cnt; i++, done++)
+        {
+          block_install (inode, inode->delay_start + done, start + i);
+          cache_write (start + i,
+                       inode->delay_buf + done * BLOCK_SECTOR_SIZE);
+        }
+      runs++;
+    }
+
+  if (done > 0)
+    {
+      lock_acquire (&writeback_lock);
+      list_remove (&inode->delay_elem);
+      delayed_cnt += done;
+      run_cnt += runs;
+      lock_release (&writeback_lock);
+      inode->delay_cnt = 0;
+    }
+  palloc_free_multiple (inode->delay_buf, DELAY_PAGES);
+  inode->delay_buf = NULL;
+}
+
+/* Allocates disk sectors for any data written to INODE that
+   delayed allocation is still holding back, and writes INODE
+   itself to the buffer cache if it has changed. */
+void
+inode_flush (struct inode *inode)
+{
+  /* Only a hint: changes made meanwhile belong to another
+     writer, which flushes them in turn. */
+  if (inode->delay_cnt == 0 && !inode->dirty)
+    return;
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rw);
+  delay_flush (inode);
+  write_back (inode);
+  rwlock_release_write (&inode->rw);
+  journal_end ();
+}
+
+/* Calls inode_flush() on every open inode that has data held
+   back by delayed allocation.  Inodes that get new data while
+   this runs may be left for the next call. */
+void
+inode_flush_all (void)
+{
+  size_t cnt;
+
+  lock_acquire (&writeback_lock);
+  cnt = list_size (&delayed_inodes);
+  lock_release (&writeback_lock);
+
+  while (cnt-- > 0)
+    {
+      struct inode *inode = NULL;
+      struct list_elem *e;
+
+      /* Skip inodes that inode_close() is already flushing. */
+      lock_acquire (&open_inodes_lock);
+      lock_acquire (&writeback_lock);
+      for (e = list_begin (&delayed_inodes); e != list_end (&delayed_inodes);
+           e = list_next (e))
+        {
+          struct inode *candidate = list_entry (e, struct inode, delay_elem);
+          if (candidate->open_cnt > 0)
+            {
+              inode = candidate;
+              inode->open_cnt++;
+              break;
+            }
+        }
+      lock_release (&writeback_lock);
+      lock_release (&open_inodes_lock);
+      if (inode == NULL)
+        break;
+
+      inode_flush (inode);
+      inode_close (inode);
+    }
+}
+
+/* Inode write-back. */
+
+/* Notes that INODE's DATA has changed, so that it is written to
+   the buffer cache at the next inode_write_dirty(), inode_flush()
+   or last inode_close(), however many changes come first.
+   INODE's RW must be held for writing, or nobody else may be able
+   to reach INODE. */
+static void
+mark_dirty (struct inode *inode)
+{
+  bool was_dirty;
+
+  lock_acquire (&writeback_lock);
+  was_dirty = inode->dirty;
+  if (!inode->dirty)
+    {
+      inode->dirty = true;
+      list_push_back (&dirty_inodes, &inode->dirty_elem);
+    }
+  change_cnt++;
+  lock_release (&writeback_lock);
+
+  /* The inode joins the running transaction at commit, but
+     counting it now lets journal_begin() hold off new operations
+     once enough inodes are dirty, too. */
+  if (!was_dirty)
+    journal_add (inode->sector);
+}
+
+/* Writes INODE's DATA to the buffer cache if it is dirty and
+   INODE has not been removed.  The caller must keep DATA from
+   changing. */
+static void
+write_back (struct inode *inode)
+{
+  lock_acquire (&writeback_lock);
+  if (inode->dirty)
+    {
+      list_remove (&inode->dirty_elem);
+      inode->dirty = false;
+      if (!inode->removed)
+        {
+          cache_write_meta (inode->sector, &inode->data);
+          write_cnt++;
+        }
+    }
+  lock_release (&writeback_lock);
+}
+
+/* Writes every dirty inode to the buffer cache.  Called by the
+   journal at commit, while no operation that could change an
+   inode is in progress, and at shutdown.  Each inode's DATA is
+   copied under its RW, which may not be acquired while holding
+   writeback_lock, so a reference keeps the inode from being
+   freed meanwhile. */
+void
+inode_write_dirty (void)
+{
+  for (;;)
+    {
+      struct inode *inode = NULL;
+      struct list_elem *e;
+
+      /* Skip inodes that inode_close() is already releasing. */
+      lock_acquire (&open_inodes_lock);
+      lock_acquire (&writeback_lock);
+      for (e = list_begin (&dirty_inodes); e != list_end (&dirty_inodes);
+           e = list_next (e))
+        {
+          struct inode *candidate = list_entry (e, struct inode, dirty_elem);
+          if (candidate->open_cnt > 0)
+            {
+              inode = candidate;
+              inode->open_cnt++;
+              break;
+            }
+        }
+      lock_release (&writeback_lock);
+      lock_release (&open_inodes_lock);
+      if (inode == NULL)
+        break;
+
+      rwlock_acquire_read (&inode->rw);
+      write_back (inode);
+      rwlock_release_read (&inode->rw);
+      inode_close (inode);
+    }
+}
@@ -7,18 +7,29 @@
 
 struct bitmap;
 
+/* -f=extents: Create new inodes with the extent layout. */
+extern bool inode_use_extents;
+
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_preallocate (struct inode *, off_t length);
+off_t inode_write_bulk (struct inode *, const void *, off_t size,
+                        off_t offset);
+void inode_flush (struct inode *);
+void inode_flush_all (void);
+void inode_write_dirty (void);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_has_extents (const struct inode *);
 
 bool inode_isdir(struct inode *node);
 void inode_set_isdir(struct inode *node, bool isdir);
@@ -27,4 +38,9 @@ struct inode *inode_get_parent_inode(struct inode *node);
 
 int inode_openers(struct inode *node);
 
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
+
+void inode_print_stats (void);
+
 #endif /* filesys/inode.h */
@@ -0,0 +1,732 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/rtc.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inode sectors, index and extent blocks, directory data and the
+   free map are metadata.  The buffer cache marks a metadata sector
+   "journaled" when it is written and will not write it back in
+   place until the running transaction that holds it has been
+   committed to the log.  Many file system operations share one
+   transaction, which is committed as a single sequential write
+   every flush interval, when it grows past TXN_LIMIT sectors, or
+   at shutdown.  Committed sectors are then written back in place
+   whenever the cache gets around to it.  Once less than
+   CHECKPOINT_RESERVE sectors of log remain, a checkpoint flushes
+   the cache and starts the log over.
+
+   Each operation that changes metadata runs between
+   journal_begin() and journal_end().  A commit waits until no
+   operation is in progress and holds off new ones until it is
+   done, so every transaction leaves the metadata consistent.
+   Calls nest, so an operation may be built out of others.
+
+   The log is a sequence of records, each one sector, tagged with
+   the journal's ID and the transaction's sequence number:
+
+     - RECORD_DATA lists up to RECORD_MAX sectors, whose new
+       contents follow the record in the log.
+
+     - RECORD_REVOKE lists sectors freed and reallocated since
+       they were last logged.  Their earlier log copies must not be
+       replayed over whatever was written there afterward.
+
+     - RECORD_COMMIT ends a transaction.
+
+   At mount, filesys_init() replays every transaction that has a
+   commit record, in order, and then starts a new log. */
+
+/* Identifies journal sectors. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Log location within the file system device. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_SIZE (JOURNAL_SECTORS - 1)
+
+/* A checkpoint starts the log over once fewer than this many log
+   sectors remain.  Every transaction up to this size fits. */
+#define CHECKPOINT_RESERVE (LOG_SIZE / 2)
+
+/* Largest transaction, in sectors, that journal_begin() lets new
+   operations join.  Journaled sectors can't be evicted, so it is
+   also limited to a quarter of the buffer cache. */
+#define TXN_LIMIT (CHECKPOINT_RESERVE / 2)
+
+/* Journal header, at JOURNAL_SECTOR. */
+struct journal_header
+  {
+    uint32_t magic;             /* JOURNAL_MAGIC. */
+    uint32_t id;                /* Distinguishes this log from old ones. */
+    uint32_t first_seq;         /* Transaction at the start of the log. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12];
+  };
+
+/* Types of log records. */
+enum record_type
+  {
+    RECORD_DATA,                /* Sector contents follow. */
+    RECORD_REVOKE,              /* Sectors not to replay. */
+    RECORD_COMMIT               /* End of transaction. */
+  };
+
+/* Sectors listed in one log record. */
+#define RECORD_MAX ((BLOCK_SECTOR_SIZE - 20) / sizeof (block_sector_t))
+
+/* A log record. */
+struct journal_record
+  {
+    uint32_t magic;             /* JOURNAL_MAGIC. */
+    uint32_t id;                /* Header's ID. */
+    uint32_t seq;               /* Transaction sequence number. */
+    uint32_t type;              /* A record_type. */
+    uint32_t cnt;               /* Number of SECTORS in use. */
+    block_sector_t sectors[RECORD_MAX];
+  };
+
+/* A growable set of sectors. */
+struct sector_set
+  {
+    block_sector_t *sectors;
+    size_t cnt, cap;
+  };
+
+/* False if the file system has no journal, or after
+   journal_done(). */
+static bool enabled;
+
+static uint32_t journal_id;             /* Header's ID. */
+static uint32_t next_seq;               /* Next transaction to commit. */
+static uint32_t log_seq;                /* Transaction at the start of the log. */
+static block_sector_t log_head;         /* Next free log sector. */
+
+/* Sectors with copies in the log since the last checkpoint. */
+static struct bitmap *logged;
+
+/* Protects the members below.  JOURNAL_COND is broadcast when
+   ACTIVE_CNT drops to zero and when a commit finishes. */
+static struct lock journal_lock;
+static struct condition journal_cond;
+static int active_cnt;                  /* Operations in progress. */
+static bool committing;                 /* Commit in progress? */
+static struct sector_set txn;           /* Running transaction. */
+static struct sector_set txn_revokes;   /* ...and its revoked sectors. */
+static size_t txn_limit;                /* Soft limit on TXN's size. */
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors written to the log. */
+static unsigned long long checkpoint_cnt; /* Times the log was reset. */
+static unsigned long long replay_cnt;   /* Sectors replayed at mount. */
+
+static void replay (void);
+static void write_header (uint32_t first_seq);
+static void checkpoint (const struct sector_set *held);
+static bool read_record (block_sector_t pos, struct journal_record *,
+                         uint32_t seq);
+
+/* Returns true if SET contains SECTOR. */
+static bool
+set_contains (const struct sector_set *set, block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < set->cnt; i++)
+    if (set->sectors[i] == sector)
+      return true;
+  return false;
+}
+
+/* Adds SECTOR to SET, if it is not already there.  Returns false
+   if memory is short. */
+static bool
+set_add (struct sector_set *set, block_sector_t sector)
+{
+  if (set_contains (set, sector))
+    return true;
+  if (set->cnt >= set->cap)
+    {
+      size_t cap = set->cap > 0 ? set->cap * 2 : 32;
+      block_sector_t *sectors = realloc (set->sectors,
+                                         cap * sizeof *sectors);
+      if (sectors == NULL)
+        return false;
+      set->sectors = sectors;
+      set->cap = cap;
+    }
+  set->sectors[set->cnt++] = sector;
+  return true;
+}
+
+/* Initializes the journal.  If FORMAT is true, creates a new,
+   empty log; otherwise replays the committed transactions in the
+   existing one.  A file system too small for a journal, or
+   formatted without one, runs without. */
+void
+journal_init (bool format)
+{
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  txn_limit = cache_size / 4 < TXN_LIMIT ? cache_size / 4 : TXN_LIMIT;
+
+  if (block_size (fs_device) <= JOURNAL_SECTOR + JOURNAL_SECTORS)
+    return;
+  logged = bitmap_create (block_size (fs_device));
+  if (logged == NULL)
+    PANIC ("can't allocate journal bitmap");
+
+  if (format)
+    {
+      struct journal_header *h = calloc (1, sizeof *h);
+      if (h == NULL)
+        PANIC ("can't allocate journal header");
+
+      /* A fresh ID keeps records left over from an earlier
+         format from being mistaken for ours. */
+      block_read (fs_device, JOURNAL_SECTOR, h);
+      journal_id = (h->magic == JOURNAL_MAGIC ? h->id + 1 : 1)
+                   ^ (uint32_t) rtc_get_time ();
+      free (h);
+      next_seq = 1;
+      write_header (next_seq);
+      enabled = true;
+    }
+  else
+    replay ();
+}
+
+/* Commits the running transaction and checkpoints the log, so
+   that the file system can be mounted without replay.  Later
+   writes bypass the journal. */
+void
+journal_done (void)
+{
+  if (!enabled)
+    return;
+  journal_commit ();
+
+  lock_acquire (&journal_lock);
+  while (committing || active_cnt > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  committing = true;
+  lock_release (&journal_lock);
+
+  checkpoint (NULL);
+  enabled = false;
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Starts an operation that changes metadata.  Every sector it
+   writes with cache_write_meta() or cache_write_meta_at() joins
+   the running transaction.  Must be followed by journal_end().
+   Should be called before acquiring any file system lock, since
+   it may wait for a commit. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing || txn.cnt >= txn_limit)
+    {
+      if (committing)
+        cond_wait (&journal_cond, &journal_lock);
+      else
+        {
+          lock_release (&journal_lock);
+          t->journal_depth--;
+          journal_commit ();
+          t->journal_depth++;
+          lock_acquire (&journal_lock);
+        }
+    }
+  active_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation started with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--active_cnt == 0)
+    cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Adds SECTOR, which the caller has just changed in the buffer
+   cache, to the running transaction.  Returns true if it may not
+   be written back in place until journal_pending() says so,
+   false if the file system has no journal. */
+bool
+journal_add (block_sector_t sector)
+{
+  if (!enabled)
+    return false;
+  lock_acquire (&journal_lock);
+  if (!set_add (&txn, sector))
+    PANIC ("out of memory for journal transaction");
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* Returns true if SECTOR belongs to the running transaction. */
+bool
+journal_pending (block_sector_t sector)
+{
+  bool pending;
+
+  lock_acquire (&journal_lock);
+  pending = set_contains (&txn, sector);
+  lock_release (&journal_lock);
+  return pending;
+}
+
+/* Notes that the CNT sectors starting at SECTOR have just been
+   allocated.  Any of them with copies in the log must not be
+   replayed once the running transaction commits. */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  if (!enabled)
+    return;
+  lock_acquire (&journal_lock);
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (logged, sector + i)
+        && !set_add (&txn_revokes, sector + i))
+      PANIC ("out of memory for journal revoke list");
+  lock_release (&journal_lock);
+}
+
+/* Gathers log sectors in a buffer of CAP sectors and writes them
+   to the log, a bufferful at a time, starting at log sector POS. */
+struct log_writer
+  {
+    uint8_t *buffer;
+    size_t cap, cnt;
+    block_sector_t pos;
+  };
+
+/* Writes out the sectors gathered in W. */
+static void
+log_flush (struct log_writer *w)
+{
+  if (w->cnt > 0)
+    block_write_multiple (fs_device, LOG_START + w->pos, w->cnt, w->buffer);
+  w->pos += w->cnt;
+  w->cnt = 0;
+}
+
+/* Returns the buffer for the next log sector in W, writing out
+   the full buffer first if necessary. */
+static void *
+log_next (struct log_writer *w)
+{
+  if (w->cnt >= w->cap)
+    log_flush (w);
+  return w->buffer + w->cnt++ * BLOCK_SECTOR_SIZE;
+}
+
+/* Adds an empty log record of the given TYPE for transaction
+   NEXT_SEQ to W and returns it. */
+static struct journal_record *
+add_record (struct log_writer *w, enum record_type type)
+{
+  struct journal_record *r = log_next (w);
+
+  memset (r, 0, sizeof *r);
+  r->magic = JOURNAL_MAGIC;
+  r->id = journal_id;
+  r->seq = next_seq;
+  r->type = type;
+  return r;
+}
+
+/* Adds LIST's CNT sectors to W in log records of the given TYPE.
+   For RECORD_DATA, copies each sector's cached contents after its
+   record. */
+static void
+add_records (struct log_writer *w, enum record_type type,
+             const block_sector_t *list, size_t cnt)
+{
+  size_t i, j;
+
+  for (i = 0; i < cnt; i += RECORD_MAX)
+    {
+      struct journal_record *r = add_record (w, type);
+      size_t n = cnt - i < RECORD_MAX ? cnt - i : RECORD_MAX;
+
+      r->cnt = n;
+      memcpy (r->sectors, list + i, n * sizeof *list);
+      if (type == RECORD_DATA)
+        for (j = 0; j < n; j++)
+          cache_read (list[i + j], log_next (w));
+    }
+}
+
+/* Returns the number of log sectors that the sectors in TXN and
+   the revocations in REVOKES take, not counting the commit
+   record. */
+static size_t
+transaction_body (const struct sector_set *txn,
+                  const struct sector_set *revokes)
+{
+  return (DIV_ROUND_UP (revokes->cnt, RECORD_MAX)
+          + DIV_ROUND_UP (txn->cnt, RECORD_MAX) + txn->cnt);
+}
+
+/* Writes the sectors in TXN and the revocations in REVOKES to the
+   log as transaction NEXT_SEQ.  Returns false if they do not fit. */
+static bool
+write_transaction (const struct sector_set *txn,
+                   const struct sector_set *revokes)
+{
+  size_t body = transaction_body (txn, revokes);
+  struct log_writer w;
+  size_t i;
+
+  if (log_head + body + 1 > LOG_SIZE)
+    return false;
+
+  /* The whole body goes out with one request if memory allows,
+     otherwise in smaller pieces. */
+  for (w.cap = body; ; w.cap /= 2)
+    {
+      w.buffer = malloc (w.cap * BLOCK_SECTOR_SIZE);
+      if (w.buffer != NULL)
+        break;
+      if (w.cap == 1)
+        PANIC ("can't allocate journal log buffer");
+    }
+  w.cnt = 0;
+  w.pos = log_head;
+
+  add_records (&w, RECORD_REVOKE, revokes->sectors, revokes->cnt);
+  add_records (&w, RECORD_DATA, txn->sectors, txn->cnt);
+
+  /* The commit record goes out only after everything it
+     vouches for is on disk. */
+  log_flush (&w);
+  add_record (&w, RECORD_COMMIT);
+  log_flush (&w);
+  free (w.buffer);
+
+  log_head += body + 1;
+  for (i = 0; i < revokes->cnt; i++)
+    bitmap_reset (logged, revokes->sectors[i]);
+  for (i = 0; i < txn->cnt; i++)
+    bitmap_mark (logged, txn->sectors[i]);
+  logged_cnt += txn->cnt;
+  commit_cnt++;
+  return true;
+}
+
+/* Commits the running transaction.  Waits for operations in
+   progress to end and holds off new ones until the transaction
+   is in the log.  Also writes out the free map, which is kept in
+   memory between commits.  Must not be called between
+   journal_begin() and journal_end(). */
+void
+journal_commit (void)
+{
+  struct thread *t = thread_current ();
+  struct sector_set commit, revokes;
+  size_t i;
+
+  ASSERT (t->journal_depth == 0);
+  if (!enabled)
+    {
+      free_map_flush ();
+      inode_write_dirty ();
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* The free map's sectors and dirty inodes join the transaction
+     like any other metadata.  Writing the free map may itself
+     dirty its inode, so it goes first. */
+  t->journal_depth++;
+  free_map_flush ();
+  inode_write_dirty ();
+  t->journal_depth--;
+
+  lock_acquire (&journal_lock);
+  commit = txn;
+  revokes = txn_revokes;
+  memset (&txn, 0, sizeof txn);
+  memset (&txn_revokes, 0, sizeof txn_revokes);
+  lock_release (&journal_lock);
+
+  if (commit.cnt > 0 || revokes.cnt > 0)
+    {
+      /* If the transaction doesn't fit in what is left of the
+         log, start the log over first.  Its own sectors are held
+         back from the cache flush, so the checkpoint copies their
+         committed versions in place from the old log instead. */
+      if (log_head > 0
+          && log_head + transaction_body (&commit, &revokes) + 1 > LOG_SIZE)
+        checkpoint (&commit);
+      /* journal_begin() and write_pieces() keep transactions
+         far smaller than the log, and writing one in place
+         instead would give up the journal's protection. */
+      if (!write_transaction (&commit, &revokes))
+        PANIC ("journal transaction of %zu sectors doesn't fit in log",
+               commit.cnt);
+      next_seq++;
+      for (i = 0; i < commit.cnt; i++)
+        cache_unjournal (commit.sectors[i]);
+    }
+  free (commit.sectors);
+  free (revokes.sectors);
+
+  if (LOG_SIZE - log_head < CHECKPOINT_RESERVE)
+    checkpoint (NULL);
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Copies the last committed version of each sector in HELD that
+   has one in the log back in place, reading it from the log.
+   The cache holds such a sector back, because the transaction
+   being committed has changed it again, so the log has its only
+   committed copy until that transaction is written. */
+static void
+restore_held (const struct sector_set *held)
+{
+  struct journal_record *r = malloc (sizeof *r);
+  uint8_t *data = malloc (BLOCK_SECTOR_SIZE);
+  block_sector_t *copies = calloc (held->cnt, sizeof *copies);
+  block_sector_t pos;
+  uint32_t seq;
+  size_t i, j;
+
+  if (r == NULL || data == NULL || copies == NULL)
+    PANIC ("can't allocate journal checkpoint buffers");
+
+  /* Find the last copy of each sector.  Log sector 0 always
+     holds a record, so a position of 0 means there is none. */
+  for (pos = 0, seq = log_seq; pos < log_head; )
+    {
+      if (!read_record (pos, r, seq))
+        PANIC ("journal log corrupt at sector %"PRDSNu, pos);
+      if (r->type == RECORD_DATA)
+        for (i = 0; i < r->cnt; i++)
+          for (j = 0; j < held->cnt; j++)
+            if (held->sectors[j] == r->sectors[i])
+              copies[j] = pos + 1 + i;
+      if (r->type == RECORD_COMMIT)
+        seq++;
+      pos += r->type == RECORD_DATA ? 1 + r->cnt : 1;
+    }
+
+  /* A sector revoked since it was logged has been freed, so its
+     logged copy is stale. */
+  for (j = 0; j < held->cnt; j++)
+    if (copies[j] != 0 && bitmap_test (logged, held->sectors[j]))
+      {
+        block_read (fs_device, LOG_START + copies[j], data);
+        block_write (fs_device, held->sectors[j], data);
+      }
+
+  free (copies);
+  free (data);
+  free (r);
+}
+
+/* Writes every committed sector back in place and starts the log
+   over.  HELD, if nonnull, lists the sectors of the transaction
+   being committed, which the cache holds back.  The caller must
+   have set COMMITTING. */
+static void
+checkpoint (const struct sector_set *held)
+{
+  ASSERT (committing);
+  if (held != NULL && held->cnt > 0)
+    restore_held (held);
+  cache_flush ();
+  write_header (next_seq);
+  bitmap_set_all (logged, false);
+  log_head = 0;
+  checkpoint_cnt++;
+}
+
+/* Writes the journal header, recording that the log now starts
+   with transaction FIRST_SEQ. */
+static void
+write_header (uint32_t first_seq)
+{
+  struct journal_header *h = calloc (1, sizeof *h);
+  if (h == NULL)
+    PANIC ("can't allocate journal header");
+  h->magic = JOURNAL_MAGIC;
+  h->id = journal_id;
+  h->first_seq = first_seq;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+  free (h);
+  log_seq = first_seq;
+}
+
+/* A revoked sector and the transaction that revoked it. */
+struct revoke
+  {
+    block_sector_t sector;
+    uint32_t seq;
+  };
+
+/* Returns true if the copy of SECTOR logged by transaction SEQ
+   was revoked by a later transaction, among the CNT in
+   REVOKES. */
+static bool
+is_revoked (const struct revoke *revokes, size_t cnt,
+            block_sector_t sector, uint32_t seq)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (revokes[i].sector == sector && revokes[i].seq > seq)
+      return true;
+  return false;
+}
+
+/* Reads the log record at log sector POS into R and returns true
+   if it belongs to transaction SEQ of this journal. */
+static bool
+read_record (block_sector_t pos, struct journal_record *r, uint32_t seq)
+{
+  if (pos >= LOG_SIZE)
+    return false;
+  block_read (fs_device, LOG_START + pos, r);
+  return (r->magic == JOURNAL_MAGIC && r->id == journal_id && r->seq == seq
+          && r->cnt <= RECORD_MAX && pos + 1 + r->cnt <= LOG_SIZE);
+}
+
+/* Replays the committed transactions in the log, then starts a
+   new log.  Disables the journal if the file system has none. */
+static void
+replay (void)
+{
+  struct journal_header *h = malloc (sizeof *h);
+  struct journal_record *r = malloc (sizeof *r);
+  uint8_t *data = malloc (BLOCK_SECTOR_SIZE);
+  struct revoke *revokes = NULL;
+  size_t revoke_cnt = 0, committed_revokes = 0;
+  uint32_t first_seq, seq;
+  block_sector_t pos;
+  size_t i;
+
+  if (h == NULL || r == NULL || data == NULL)
+    PANIC ("can't allocate journal replay buffers");
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != JOURNAL_MAGIC)
+    {
+      printf ("filesys: no journal\n");
+      goto done;
+    }
+  journal_id = h->id;
+  first_seq = h->first_seq;
+
+  /* Find the committed transactions and what they revoked.
+     Revocations in a transaction without a commit record don't
+     count. */
+  for (pos = 0, seq = first_seq; read_record (pos, r, seq); )
+    if (r->type == RECORD_COMMIT)
+      {
+        committed_revokes = revoke_cnt;
+        seq++;
+        pos++;
+      }
+    else if (r->type == RECORD_REVOKE)
+      {
+        revokes = realloc (revokes, (revoke_cnt + r->cnt) * sizeof *revokes);
+        if (revokes == NULL)
+          PANIC ("can't allocate journal revoke table");
+        for (i = 0; i < r->cnt; i++)
+          {
+            revokes[revoke_cnt].sector = r->sectors[i];
+            revokes[revoke_cnt++].seq = r->seq;
+          }
+        pos++;
+      }
+    else if (r->type == RECORD_DATA)
+      pos += 1 + r->cnt;
+    else
+      break;
+
+  /* Apply them in order. */
+  for (pos = 0, next_seq = first_seq; next_seq < seq; )
+    {
+      if (!read_record (pos, r, next_seq))
+        PANIC ("journal changed during replay");
+      if (r->type == RECORD_DATA)
+        for (i = 0; i < r->cnt; i++)
+          if (!is_revoked (revokes, committed_revokes, r->sectors[i],
+                           next_seq))
+            {
+              block_read (fs_device, LOG_START + pos + 1 + i, data);
+              block_write (fs_device, r->sectors[i], data);
+              replay_cnt++;
+            }
+      if (r->type == RECORD_COMMIT)
+        next_seq++;
+      pos += r->type == RECORD_DATA ? 1 + r->cnt : 1;
+    }
+  if (seq != first_seq)
+    printf ("filesys: replayed %"PRIu32" journal transaction%s\n",
+            seq - first_seq, seq - first_seq != 1 ? "s" : "");
+
+  /* Everything replayed is on disk, so start a new log. */
+  write_header (next_seq);
+  enabled = true;
+
+ done:
+  free (revokes);
+  free (data);
+  free (r);
+  free (h);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu commits, %llu sectors logged, %llu checkpoints, "
+          "%llu sectors replayed\n",
+          commit_cnt, logged_cnt, checkpoint_cnt, replay_cnt);
+}
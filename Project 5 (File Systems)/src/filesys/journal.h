@@ -0,0 +1,21 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+
+bool journal_add (block_sector_t);
+bool journal_pending (block_sector_t);
+void journal_revoke (block_sector_t, size_t cnt);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -358,6 +358,26 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B that hold bits START through START + CNT
+   - 1 to FILE, at the offsets bitmap_write() would use for them.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t first, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+  if (cnt == 0)
+    return true;
+
+  first = start / CHAR_BIT;
+  size = (start + cnt - 1) / CHAR_BIT - first + 1;
+  return file_write_at (file, (uint8_t *) b->bits + first,
+                        size, first) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -15,6 +16,52 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* A directory entry written by getdents(). */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated file name. */
+  };
+
+/* One buffer for readv() or writev(). */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Length of buffer in bytes. */
+  };
+
+/* Maximum number of buffers passed to readv() or writev(). */
+#define IOV_MAX 64
+
+/* Block device roles, for iostat(). */
+enum iostat_role
+  {
+    IOSTAT_KERNEL,              /* Pintos OS kernel. */
+    IOSTAT_FILESYS,             /* File system. */
+    IOSTAT_SCRATCH,             /* Scratch. */
+    IOSTAT_SWAP                 /* Swap. */
+  };
+
+/* Number of buckets in iostat's latency histogram. */
+#define IOSTAT_BUCKETS 40
+
+/* Block I/O statistics for the device in one role.  Only
+   READ_BYTES and WRITE_BYTES are kept unless the kernel was
+   started with -iostat. */
+struct iostat
+  {
+    char device[16];            /* Device name, e.g. "hda2". */
+    unsigned long long read_bytes;      /* Bytes read. */
+    unsigned long long write_bytes;     /* Bytes written. */
+    unsigned long long seq_cnt;         /* Sequential requests. */
+    unsigned long long random_cnt;      /* Non-sequential requests. */
+    unsigned int max_depth;             /* Peak requests in flight. */
+    unsigned long long latency[IOSTAT_BUCKETS];
+                                /* Requests taking 2**I to 2**(I+1) - 1
+                                   time stamp counter cycles. */
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -45,4 +92,18 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Positional and vectored I/O. */
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int getdents (int fd, struct dirent *, unsigned size);
+
+/* Durability. */
+bool fsync (int fd);
+void sync (void);
+
+/* Statistics. */
+bool iostat (int role, struct iostat *);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,41 @@
+/* Writes a file and syncs it and a directory to disk with
+   fsync(), and checks that fsync() rejects descriptors that are
+   not open.  The persistence check verifies the data after the
+   file system is mounted again. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 3210
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  int fd, dir_fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (write (fd, buf, sizeof buf) == FILE_SIZE, "write \"a\"");
+  CHECK (fsync (fd), "fsync \"a\"");
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  CHECK (fsync (dir_fd), "fsync \"d\"");
+
+  CHECK (!fsync (0), "fsync stdin (must return false)");
+  CHECK (!fsync (-1), "fsync -1 (must return false)");
+  CHECK (!fsync (1234), "fsync 1234 (must return false)");
+  msg ("close \"d\"");
+  close (dir_fd);
+  CHECK (!fsync (dir_fd), "fsync closed fd (must return false)");
+
+  msg ("close \"a\"");
+  close (fd);
+  check_file ("a", buf, sizeof buf);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "a"
+(fsync) open "a"
+(fsync) write "a"
+(fsync) fsync "a"
+(fsync) mkdir "d"
+(fsync) open "d"
+(fsync) fsync "d"
+(fsync) fsync stdin (must return false)
+(fsync) fsync -1 (must return false)
+(fsync) fsync 1234 (must return false)
+(fsync) close "d"
+(fsync) fsync closed fd (must return false)
+(fsync) close "a"
+(fsync) open "a" for verification
+(fsync) verified contents of "a"
+(fsync) close "a"
+(fsync) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir);
+$dir->{"f$_"} = [''] foreach 0...29;
+$dir->{"d$_"} = {} foreach 0...4;
+check_archive ({"dir" => $dir, "file" => ['']});
+pass;
@@ -0,0 +1,131 @@
+/* Fills a directory with more entries than getdents() copies in
+   one batch and lists it a few entries at a time, mixing in
+   readdir() calls, checking that every entry shows up exactly
+   once with the right type and inode number.  Also checks that
+   getdents() fails on a file. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 30
+#define DIR_CNT 5
+#define ENTRY_CNT (FILE_CNT + DIR_CNT)
+
+static int seen[ENTRY_CNT];
+
+/* Returns the index of entry NAME, "fN" or "dN", failing if it
+   is not one of ours. */
+static int
+entry_index (const char *name)
+{
+  int i;
+
+  for (i = 0; i < ENTRY_CNT; i++)
+    {
+      char expected[16];
+      if (i < FILE_CNT)
+        snprintf (expected, sizeof expected, "f%d", i);
+      else
+        snprintf (expected, sizeof expected, "d%d", i - FILE_CNT);
+      if (!strcmp (name, expected))
+        return i;
+    }
+  fail ("unexpected entry \"%s\"", name);
+}
+
+/* Notes that entry NAME was listed, and checks that it is a
+   directory if IS_DIR and has inode number INUM, unless INUM is
+   -1. */
+static void
+check_entry (const char *name, bool is_dir, int inum)
+{
+  int i = entry_index (name);
+  char path[32];
+  int fd;
+
+  if (seen[i]++)
+    fail ("\"%s\" listed twice", name);
+  if (is_dir != (i >= FILE_CNT))
+    fail ("\"%s\" listed as a %s", name, is_dir ? "directory" : "file");
+
+  snprintf (path, sizeof path, "dir/%s", name);
+  fd = open (path);
+  if (fd < 2)
+    fail ("open \"%s\"", path);
+  if (isdir (fd) != is_dir)
+    fail ("isdir \"%s\" disagrees with getdents", path);
+  if (inum != -1 && inumber (fd) != inum)
+    fail ("\"%s\" listed with inode %d, actually %d",
+          path, inum, inumber (fd));
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  struct dirent ents[3];
+  char name[READDIR_MAX_LEN + 1];
+  int dir_fd, file_fd, i, n;
+  bool more = true;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  msg ("create %d files and %d directories in \"dir\"", FILE_CNT, DIR_CNT);
+  for (i = 0; i < ENTRY_CNT; i++)
+    {
+      char path[32];
+      if (i < FILE_CNT)
+        {
+          snprintf (path, sizeof path, "dir/f%d", i);
+          if (!create (path, 0))
+            fail ("create \"%s\"", path);
+        }
+      else
+        {
+          snprintf (path, sizeof path, "dir/d%d", i - FILE_CNT);
+          if (!mkdir (path))
+            fail ("mkdir \"%s\"", path);
+        }
+    }
+
+  CHECK ((dir_fd = open ("dir")) > 1, "open \"dir\"");
+  msg ("list \"dir\" with getdents and readdir");
+  while (more)
+    {
+      n = getdents (dir_fd, ents, sizeof ents);
+      if (n < 0 || n > 3)
+        fail ("getdents returned %d", n);
+      for (i = 0; i < n; i++)
+        check_entry (ents[i].name, ents[i].is_dir, ents[i].inumber);
+
+      /* A readdir() between batches must pick up where getdents()
+         left off, and the next getdents() where it did. */
+      more = readdir (dir_fd, name);
+      if (more)
+        {
+          if (n == 0)
+            fail ("readdir found \"%s\" after getdents found the end",
+                  name);
+          check_entry (name, entry_index (name) >= FILE_CNT, -1);
+        }
+    }
+  for (i = 0; i < ENTRY_CNT; i++)
+    if (!seen[i])
+      fail ("entry %d never listed", i);
+  msg ("every entry listed once");
+  CHECK (getdents (dir_fd, ents, sizeof ents) == 0,
+         "getdents at end of \"dir\" returns 0");
+  msg ("close \"dir\"");
+  close (dir_fd);
+
+  CHECK (create ("file", 0), "create \"file\"");
+  CHECK ((file_fd = open ("file")) > 1, "open \"file\"");
+  CHECK (getdents (file_fd, ents, sizeof ents) == -1,
+         "getdents \"file\" (must return -1)");
+  CHECK (getdents (1234, ents, sizeof ents) == -1,
+         "getdents 1234 (must return -1)");
+  msg ("close \"file\"");
+  close (file_fd);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(getdents) begin
+(getdents) mkdir "dir"
+(getdents) create 30 files and 5 directories in "dir"
+(getdents) open "dir"
+(getdents) list "dir" with getdents and readdir
+(getdents) every entry listed once
+(getdents) getdents at end of "dir" returns 0
+(getdents) close "dir"
+(getdents) create "file"
+(getdents) open "file"
+(getdents) getdents "file" (must return -1)
+(getdents) getdents 1234 (must return -1)
+(getdents) close "file"
+(getdents) end
+EOF
+pass;
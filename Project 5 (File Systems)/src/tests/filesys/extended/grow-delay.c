@@ -0,0 +1,42 @@
+/* Writes a file that delayed allocation holds back from disk,
+   then reads the data back before the file is closed: through a
+   second file descriptor and after seeking back into it. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 5678
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "delayed";
+  char block[1000];
+  int fd, fd2;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == FILE_SIZE,
+         "write \"%s\"", file_name);
+
+  CHECK ((fd2 = open (file_name)) > 1, "open \"%s\" again", file_name);
+  check_file_handle (fd2, file_name, buf, sizeof buf);
+  msg ("close second \"%s\"", file_name);
+  close (fd2);
+
+  msg ("seek \"%s\" back", file_name);
+  seek (fd, 1234);
+  CHECK (read (fd, block, sizeof block) == sizeof block,
+         "read \"%s\"", file_name);
+  compare_bytes (block, buf + 1234, sizeof block, 1234, file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
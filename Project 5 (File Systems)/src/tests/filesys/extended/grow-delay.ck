@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-delay) begin
+(grow-delay) create "delayed"
+(grow-delay) open "delayed"
+(grow-delay) write "delayed"
+(grow-delay) open "delayed" again
+(grow-delay) verified contents of "delayed"
+(grow-delay) close second "delayed"
+(grow-delay) seek "delayed" back
+(grow-delay) read "delayed"
+(grow-delay) close "delayed"
+(grow-delay) open "delayed" for verification
+(grow-delay) verified contents of "delayed"
+(grow-delay) close "delayed"
+(grow-delay) end
+EOF
+pass;
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir);
+for my $i (0...39) {
+    my ($name) = "dir/file$i";
+    $dir->{"file$i"} = [$name . "\0" x (32 - length ($name))];
+}
+check_archive ({"dir" => $dir});
+pass;
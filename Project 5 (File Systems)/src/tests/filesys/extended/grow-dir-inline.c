@@ -0,0 +1,46 @@
+/* Creates files in a directory one at a time, well past the 24
+   entries its inode holds inline, and after each one checks that
+   every file created so far can still be found and read. */
+
+#include <syscall.h>
+#include <stdio.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 40
+
+void
+test_main (void) 
+{
+  int i, j;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  msg ("create and check %d files in \"dir\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[32] = "";
+      int fd;
+
+      snprintf (name, sizeof name, "dir/file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\"", name);
+      if (write (fd, name, sizeof name) != sizeof name)
+        fail ("write \"%s\"", name);
+      close (fd);
+
+      for (j = 0; j <= i; j++)
+        {
+          char expected[32] = "", actual[32];
+
+          snprintf (expected, sizeof expected, "dir/file%d", j);
+          if ((fd = open (expected)) < 2)
+            fail ("\"%s\" lost after creating \"%s\"", expected, name);
+          if (read (fd, actual, sizeof actual) != sizeof actual)
+            fail ("read \"%s\"", expected);
+          compare_bytes (actual, expected, sizeof actual, 0, expected);
+          close (fd);
+        }
+    }
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-dir-inline) begin
+(grow-dir-inline) mkdir "dir"
+(grow-dir-inline) create and check 40 files in "dir"
+(grow-dir-inline) end
+EOF
+pass;
@@ -0,0 +1,4 @@
+/* Same as grow-hole, on a file system formatted with extent-based
+   inodes. */
+
+#include "tests/filesys/extended/grow-hole.inc"
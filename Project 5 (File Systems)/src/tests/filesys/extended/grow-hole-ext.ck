@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-hole-ext) begin
+(grow-hole-ext) create "testfile"
+(grow-hole-ext) open "testfile"
+(grow-hole-ext) write bytes 0 to 100 of "testfile"
+(grow-hole-ext) write bytes 90000 to 91000 of "testfile"
+(grow-hole-ext) verified contents of "testfile"
+(grow-hole-ext) write bytes 40000 to 40300 of "testfile"
+(grow-hole-ext) verified contents of "testfile"
+(grow-hole-ext) close "testfile"
+(grow-hole-ext) open "testfile" for verification
+(grow-hole-ext) verified contents of "testfile"
+(grow-hole-ext) close "testfile"
+(grow-hole-ext) end
+EOF
+pass;
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = "\0" x 91000;
+substr ($data, 0, 100) = random_bytes (100);
+substr ($data, 90000, 1000) = random_bytes (1000);
+substr ($data, 40000, 300) = random_bytes (300);
+check_archive ({"testfile" => [$data]});
+pass;
@@ -0,0 +1,6 @@
+/* Writes a few bytes to a new file, then writes past its end,
+   leaving a hole that runs from the file's first sector into its
+   indirect blocks.  Checks that the hole reads as zeros, both
+   before and after writing into the middle of it. */
+
+#include "tests/filesys/extended/grow-hole.inc"
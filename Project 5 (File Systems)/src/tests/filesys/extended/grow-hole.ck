@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-hole) begin
+(grow-hole) create "testfile"
+(grow-hole) open "testfile"
+(grow-hole) write bytes 0 to 100 of "testfile"
+(grow-hole) write bytes 90000 to 91000 of "testfile"
+(grow-hole) verified contents of "testfile"
+(grow-hole) write bytes 40000 to 40300 of "testfile"
+(grow-hole) verified contents of "testfile"
+(grow-hole) close "testfile"
+(grow-hole) open "testfile" for verification
+(grow-hole) verified contents of "testfile"
+(grow-hole) close "testfile"
+(grow-hole) end
+EOF
+pass;
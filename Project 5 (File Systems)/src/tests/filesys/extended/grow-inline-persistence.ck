@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (1000);
+check_archive ({"testfile" => [$data],
+		"straddle" => [substr ($data, 0, 700)]});
+pass;
@@ -0,0 +1,49 @@
+/* Grows a file up to the 496 bytes its inode holds inline, one
+   byte past that, and then on to 1,000 bytes, checking after each
+   step that moving the data out of the inode kept it intact.
+   Then writes a second file with a single write that straddles
+   the inline limit. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1000];
+
+/* Writes BUF[OFS, OFS + SIZE) to FD at OFS, then checks that the
+   file holds the first OFS + SIZE bytes of BUF. */
+static void
+write_and_check (int fd, const char *file_name, size_t ofs, size_t size)
+{
+  seek (fd, ofs);
+  CHECK (write (fd, buf + ofs, size) == (int) size,
+         "write bytes %zu to %zu of \"%s\"", ofs, ofs + size, file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, ofs + size);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("testfile", 0), "create \"testfile\"");
+  CHECK ((fd = open ("testfile")) > 1, "open \"testfile\"");
+  write_and_check (fd, "testfile", 0, 400);
+  write_and_check (fd, "testfile", 400, 96);
+  write_and_check (fd, "testfile", 496, 1);
+  write_and_check (fd, "testfile", 497, 503);
+  msg ("close \"testfile\"");
+  close (fd);
+
+  CHECK (create ("straddle", 0), "create \"straddle\"");
+  CHECK ((fd = open ("straddle")) > 1, "open \"straddle\"");
+  write_and_check (fd, "straddle", 0, 300);
+  write_and_check (fd, "straddle", 300, 400);
+  msg ("close \"straddle\"");
+  close (fd);
+  check_file ("straddle", buf, 700);
+}
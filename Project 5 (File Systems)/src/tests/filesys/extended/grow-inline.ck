@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "testfile"
+(grow-inline) open "testfile"
+(grow-inline) write bytes 0 to 400 of "testfile"
+(grow-inline) verified contents of "testfile"
+(grow-inline) write bytes 400 to 496 of "testfile"
+(grow-inline) verified contents of "testfile"
+(grow-inline) write bytes 496 to 497 of "testfile"
+(grow-inline) verified contents of "testfile"
+(grow-inline) write bytes 497 to 1000 of "testfile"
+(grow-inline) verified contents of "testfile"
+(grow-inline) close "testfile"
+(grow-inline) create "straddle"
+(grow-inline) open "straddle"
+(grow-inline) write bytes 0 to 300 of "straddle"
+(grow-inline) verified contents of "straddle"
+(grow-inline) write bytes 300 to 700 of "straddle"
+(grow-inline) verified contents of "straddle"
+(grow-inline) close "straddle"
+(grow-inline) open "straddle" for verification
+(grow-inline) verified contents of "straddle"
+(grow-inline) close "straddle"
+(grow-inline) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($d);
+$d->{"f$_"} = [""] foreach 0...39;
+check_archive ({"big" => [random_bytes (150000)], "d" => $d});
+pass;
@@ -0,0 +1,42 @@
+/* Runs with a buffer cache so small that the journal commits
+   after every couple of metadata sectors: writes a large file
+   with a single write, which the file system must split across
+   several transactions, and fills a directory.  The persistence
+   check verifies that all of it reached the disk. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 150000
+#define FILE_CNT 40
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  int fd, i;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("big", 0), "create \"big\"");
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  CHECK (write (fd, buf, sizeof buf) == FILE_SIZE, "write \"big\"");
+  msg ("close \"big\"");
+  close (fd);
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  msg ("create %d files in \"d\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[32];
+      snprintf (name, sizeof name, "d/f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  check_file ("big", buf, sizeof buf);
+}
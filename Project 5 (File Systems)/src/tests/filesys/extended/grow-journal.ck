@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-journal) begin
+(grow-journal) create "big"
+(grow-journal) open "big"
+(grow-journal) write "big"
+(grow-journal) close "big"
+(grow-journal) mkdir "d"
+(grow-journal) create 40 files in "d"
+(grow-journal) open "big" for verification
+(grow-journal) verified contents of "big"
+(grow-journal) close "big"
+(grow-journal) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($a) = random_bytes (1300);
+substr ($a, 600, 400) = "\0" x 400;
+check_archive ({"a" => [$a]});
+pass;
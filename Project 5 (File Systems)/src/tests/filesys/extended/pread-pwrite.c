@@ -0,0 +1,65 @@
+/* Reads and writes a file at given offsets with pread() and
+   pwrite(), checking that neither moves the file position, that
+   pwrite() past end of file leaves a hole of zeros, and that
+   both reject descriptors that are not open regular files. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1300];
+static char block[300];
+
+static void
+check_tell (int fd, unsigned ofs)
+{
+  unsigned pos = tell (fd);
+  if (pos != ofs)
+    fail ("file position moved: should be %u, actually %u", ofs, pos);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  memset (buf + 600, 0, 400);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (write (fd, buf, 600) == 600, "write 600 bytes to \"a\"");
+
+  CHECK (pwrite (fd, buf + 1000, 300, 1000) == 300,
+         "pwrite 300 bytes at offset 1000");
+  check_tell (fd, 600);
+  CHECK (filesize (fd) == 1300, "filesize is 1300");
+
+  CHECK (pread (fd, block, sizeof block, 100) == sizeof block,
+         "pread 300 bytes at offset 100");
+  compare_bytes (block, buf + 100, sizeof block, 100, "a");
+  CHECK (pread (fd, block, sizeof block, 800) == sizeof block,
+         "pread 300 bytes at offset 800");
+  compare_bytes (block, buf + 800, sizeof block, 800, "a");
+  check_tell (fd, 600);
+
+  CHECK (pread (fd, block, sizeof block, 1200) == 100,
+         "pread across end of file reads 100 bytes");
+  CHECK (pread (fd, block, sizeof block, 5000) == 0,
+         "pread past end of file reads nothing");
+  check_tell (fd, 600);
+
+  CHECK (pread (0, block, sizeof block, 0) == -1,
+         "pread stdin (must return -1)");
+  CHECK (pwrite (1, buf, 10, 0) == -1, "pwrite stdout (must return -1)");
+  CHECK (pread (1234, block, sizeof block, 0) == -1,
+         "pread 1234 (must return -1)");
+  CHECK (pwrite (1234, buf, 10, 0) == -1, "pwrite 1234 (must return -1)");
+
+  msg ("close \"a\"");
+  close (fd);
+  check_file ("a", buf, sizeof buf);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pread-pwrite) begin
+(pread-pwrite) create "a"
+(pread-pwrite) open "a"
+(pread-pwrite) write 600 bytes to "a"
+(pread-pwrite) pwrite 300 bytes at offset 1000
+(pread-pwrite) filesize is 1300
+(pread-pwrite) pread 300 bytes at offset 100
+(pread-pwrite) pread 300 bytes at offset 800
+(pread-pwrite) pread across end of file reads 100 bytes
+(pread-pwrite) pread past end of file reads nothing
+(pread-pwrite) pread stdin (must return -1)
+(pread-pwrite) pwrite stdout (must return -1)
+(pread-pwrite) pread 1234 (must return -1)
+(pread-pwrite) pwrite 1234 (must return -1)
+(pread-pwrite) close "a"
+(pread-pwrite) open "a" for verification
+(pread-pwrite) verified contents of "a"
+(pread-pwrite) close "a"
+(pread-pwrite) end
+EOF
+pass;
@@ -0,0 +1,19 @@
+/* Passes readv() a buffer in kernel memory.  The process must be
+   terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static char buf[16];
+  struct iovec iov[2] = { { buf, sizeof buf }, { (char *) 0xc0100000, 123 } };
+  int fd;
+
+  CHECK (create ("a", 100), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  readv (fd, iov, 2);
+  fail ("should not have survived readv()");
+}
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($a) = random_bytes (2000);
+check_archive ({"a" => [$a . substr ($a, 0, 64)]});
+pass;
@@ -0,0 +1,55 @@
+/* Writes a file from several buffers with one writev() and reads
+   it back into differently split buffers with one readv(), then
+   checks that both reject bad buffer counts and descriptors. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2000];
+static char in[2000];
+
+void
+test_main (void) 
+{
+  struct iovec out_iov[4] = {
+    { buf, 700 }, { buf + 700, 0 }, { buf + 700, 512 }, { buf + 1212, 788 },
+  };
+  struct iovec in_iov[3] = {
+    { in, 1 }, { in + 1, 1500 }, { in + 1501, 1000 },
+  };
+  struct iovec many[IOV_MAX + 1];
+  int fd, i;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  for (i = 0; i < IOV_MAX + 1; i++)
+    {
+      many[i].iov_base = buf + i;
+      many[i].iov_len = 1;
+    }
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (writev (fd, out_iov, 4) == 2000, "writev 2000 bytes from 4 buffers");
+  CHECK (tell (fd) == 2000, "tell \"a\" is 2000");
+
+  msg ("seek \"a\" to 0");
+  seek (fd, 0);
+  CHECK (readv (fd, in_iov, 3) == 2000,
+         "readv 2000 bytes into 3 buffers of 2501");
+  compare_bytes (in, buf, sizeof buf, 0, "a");
+  CHECK (readv (fd, in_iov, 3) == 0, "readv at end of file reads nothing");
+
+  CHECK (writev (fd, many, IOV_MAX) == IOV_MAX,
+         "writev IOV_MAX buffers");
+  CHECK (writev (fd, many, IOV_MAX + 1) == -1,
+         "writev IOV_MAX + 1 buffers (must return -1)");
+  CHECK (readv (fd, many, 0) == -1, "readv 0 buffers (must return -1)");
+  CHECK (readv (1234, in_iov, 3) == -1, "readv 1234 (must return -1)");
+  CHECK (writev (1234, out_iov, 4) == -1, "writev 1234 (must return -1)");
+
+  msg ("close \"a\"");
+  close (fd);
+}
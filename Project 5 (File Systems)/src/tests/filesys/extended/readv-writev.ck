@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "a"
+(readv-writev) open "a"
+(readv-writev) writev 2000 bytes from 4 buffers
+(readv-writev) tell "a" is 2000
+(readv-writev) seek "a" to 0
+(readv-writev) readv 2000 bytes into 3 buffers of 2501
+(readv-writev) readv at end of file reads nothing
+(readv-writev) writev IOV_MAX buffers
+(readv-writev) writev IOV_MAX + 1 buffers (must return -1)
+(readv-writev) readv 0 buffers (must return -1)
+(readv-writev) readv 1234 (must return -1)
+(readv-writev) writev 1234 (must return -1)
+(readv-writev) close "a"
+(readv-writev) end
+EOF
+pass;
@@ -34,6 +34,8 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -123,7 +125,10 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init ();
   locate_block_devices ();
+  if (ramdisk_preload)
+    ramdisk_load (block_get_role (BLOCK_SCRATCH));
   filesys_init (format_filesys);
 #endif
 
@@ -242,11 +247,56 @@ parse_options (char **argv)
         shutdown_configure (SHUTDOWN_REBOOT);
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
-        format_filesys = true;
+        {
+          format_filesys = true;
+          if (value != NULL && !strcmp (value, "extents"))
+            inode_use_extents = true;
+          else if (value != NULL)
+            PANIC ("unknown inode layout `%s' (use -h for help)", value);
+        }
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          if (value == NULL || *value == '\0'
+              || value[strspn (value, "0123456789")] != '\0'
+              || (cache_size = atoi (value)) < CACHE_MIN_SIZE)
+            PANIC ("bad cache size `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-flush"))
+        {
+          if (value == NULL || *value == '\0'
+              || value[strspn (value, "0123456789")] != '\0')
+            PANIC ("bad flush interval `%s' (use -h for help)", value);
+          cache_flush_ms = atoi (value);
+        }
+      else if (!strcmp (name, "-dirty-ratio"))
+        {
+          if (value == NULL || *value == '\0'
+              || value[strspn (value, "0123456789")] != '\0'
+              || strlen (value) > 3
+              || (cache_dirty_ratio = atoi (value)) < 1
+              || cache_dirty_ratio > 100)
+            PANIC ("bad dirty ratio `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-dma"))
+        ide_use_dma = true;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          char *preload = value != NULL ? strchr (value, ',') : NULL;
+          ramdisk_size = value != NULL ? atoi (value) : 0;
+          if (ramdisk_size == 0)
+            PANIC ("bad RAM disk size `%s' (use -h for help)", value);
+          if (preload != NULL && !strcmp (preload, ",preload"))
+            ramdisk_preload = true;
+          else if (preload != NULL)
+            PANIC ("unknown RAM disk option `%s' (use -h for help)",
+                   preload + 1);
+        }
+      else if (!strcmp (name, "-iostat"))
+        block_detailed_stats = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -371,8 +421,16 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -f=extents         Format it with extent-based inodes.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Cache SECTORS sectors, at least 8 (default 64).\n"
+          "  -flush=MS          Flush the cache every MS ms, 0 for never (default 5000).\n"
+          "  -dirty-ratio=PCT   Flush early once PCT%% of the cache is dirty (default 50).\n"
+          "  -dma               Use bus-master DMA for IDE disks if possible.\n"
+          "  -ramdisk=SECTORS   Create RAM disk ram0 of SECTORS sectors.\n"
+          "  -ramdisk=SECTORS,preload  Also fill it from the scratch device.\n"
+          "  -iostat            Collect block I/O latency and locality stats.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -119,6 +119,7 @@ struct thread
    int last_fd; // the fd that was last assigned, used to find next open fd
 
    struct dir *cwd; // current working directory
+   int journal_depth; // nesting depth of journal_begin() calls
 
    int exit_status; // exit status of this thread
 
@@ -8,13 +8,16 @@
 #include "threads/synch.h"
 #include "userprog/pagedir.h"
 #include "lib/user/syscall.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "userprog/process.h"
 #include "threads/palloc.h"
 
@@ -38,12 +41,20 @@ bool mkdir_helper (const char *dir);
 bool readdir_helper (int fd, char *name);
 bool isdir_helper (int fd);
 int inumber_helper (int fd);
+int pread_helper (int fd, void *buffer, unsigned size, unsigned offset);
+int pwrite_helper (int fd, const void *buffer, unsigned size,
+                   unsigned offset);
+int readv_helper (int fd, const struct iovec *iov, int iovcnt);
+int writev_helper (int fd, const struct iovec *iov, int iovcnt);
+int getdents_helper (int fd, struct dirent *entries, unsigned size);
+bool fsync_helper (int fd);
+void sync_helper (void);
+bool iostat_helper (int role, struct iostat *stats);
 
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&syscall_lock);
 }
 
 static void
@@ -59,16 +70,21 @@ syscall_handler (struct intr_frame *f)
   // DRIVER: ALL, see helpers
   switch (syscall)
   {
+    // 4 arguments
+    case SYS_PREAD: case SYS_PWRITE:
+    validate_pointer(myEsp + 16);
     // 3 arguments
-    case SYS_WRITE: case SYS_READ:
+    case SYS_WRITE: case SYS_READ: case SYS_READV: case SYS_WRITEV:
+    case SYS_GETDENTS:
     validate_pointer(myEsp + 12);
     // 2 arguments
-    case SYS_CREATE: case SYS_SEEK: case SYS_READDIR:
+    case SYS_CREATE: case SYS_SEEK: case SYS_READDIR: case SYS_IOSTAT:
     validate_pointer(myEsp + 8);
     // 1 argument
     case SYS_EXIT: case SYS_WAIT: case SYS_OPEN: case SYS_REMOVE:
     case SYS_TELL: case SYS_EXEC: case SYS_FILESIZE: case SYS_CLOSE:
     case SYS_CHDIR: case SYS_MKDIR: case SYS_ISDIR: case SYS_INUMBER:
+    case SYS_FSYNC:
     validate_pointer(myEsp + 4);
   }
 
@@ -134,6 +150,41 @@ syscall_handler (struct intr_frame *f)
     case SYS_INUMBER:
       f->eax = inumber_helper(*(int *)(myEsp + 4));
       break;
+    case SYS_PREAD:
+      f->eax = pread_helper(*(int *)(myEsp + 4), *(void **)(myEsp + 8),
+                            *(unsigned *)(myEsp + 12),
+                            *(unsigned *)(myEsp + 16));
+      break;
+    case SYS_PWRITE:
+      f->eax = pwrite_helper(*(int *)(myEsp + 4), *(void **)(myEsp + 8),
+                             *(unsigned *)(myEsp + 12),
+                             *(unsigned *)(myEsp + 16));
+      break;
+    case SYS_READV:
+      f->eax = readv_helper(*(int *)(myEsp + 4),
+                            *(struct iovec **)(myEsp + 8),
+                            *(int *)(myEsp + 12));
+      break;
+    case SYS_WRITEV:
+      f->eax = writev_helper(*(int *)(myEsp + 4),
+                             *(struct iovec **)(myEsp + 8),
+                             *(int *)(myEsp + 12));
+      break;
+    case SYS_GETDENTS:
+      f->eax = getdents_helper(*(int *)(myEsp + 4),
+                               *(struct dirent **)(myEsp + 8),
+                               *(unsigned *)(myEsp + 12));
+      break;
+    case SYS_FSYNC:
+      f->eax = fsync_helper(*(int *)(myEsp + 4));
+      break;
+    case SYS_SYNC:
+      sync_helper();
+      break;
+    case SYS_IOSTAT:
+      f->eax = iostat_helper(*(int *)(myEsp + 4),
+                             *(struct iostat **)(myEsp + 8));
+      break;
     
   } 
 }
@@ -142,7 +193,7 @@ syscall_handler (struct intr_frame *f)
 // relative or absolute. Returns true if successful, false on failure.
 bool chdir_helper (const char *dir) {
   struct inode *new_dir;
-  if (!filesys_parse_path(dir, &new_dir, NULL)) {
+  if (!filesys_parse_path(dir, &new_dir)) {
     return false;
   }
 
@@ -154,14 +205,19 @@ bool chdir_helper (const char *dir) {
 
 bool mkdir_helper (const char *dir) {  
   struct dir *parent_dir;
-  char *name;
-  if (!filesys_check_path(dir, &parent_dir, &name)) {
+  char name[NAME_MAX + 1];
+  journal_begin();
+  if (!filesys_check_path(dir, &parent_dir, name)) {
+    journal_end();
     return false;
   }
   
+  // place the new inode near its parent directory's
   block_sector_t inode_sector = 0;
   bool success = (parent_dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (1, inode_get_inumber (
+                                                  dir_get_inode (parent_dir)),
+                                             &inode_sector)
                   && dir_create (inode_sector, 16)
                   && dir_add (parent_dir, name, inode_sector));
   if (!success && inode_sector != 0) 
@@ -170,6 +226,8 @@ bool mkdir_helper (const char *dir) {
   struct inode *node = inode_open(inode_sector);
   inode_set_parent_inode(node, inode_get_inumber(dir_get_inode(parent_dir)));
   inode_close(node);
+  dir_close(parent_dir);
+  journal_end();
 
   return success;
 }
@@ -212,7 +270,6 @@ void close_helper(int fd)
   if(fd < 3 || fd > 127){
     return;
   }
-  lock_acquire(&syscall_lock);
   if (thread_current()->files[fd]) {
     file_close(thread_current()->files[fd]);
     thread_current()->files[fd] = NULL;
@@ -221,7 +278,6 @@ void close_helper(int fd)
     thread_current()->dirs[fd] = NULL;    
   }
   thread_current()->num_files_open--;
-  lock_release(&syscall_lock);
 }
 
 // DRIVER: TIMOTHY
@@ -245,49 +301,36 @@ int exec_helper(const char *cmd_line)
 
 // DRIVER: PREETH
 unsigned tell_helper(int fd){
-  lock_acquire(&syscall_lock);
   if(!is_file_open(fd)){
-    lock_release(&syscall_lock);
     return -1;
   }
   int ans = file_tell(thread_current()->files[fd]);
-  lock_release(&syscall_lock);
   return ans;
 }
 
 // DRIVER: JUSTIN
 void seek_helper(int fd, unsigned position){
-  lock_acquire(&syscall_lock);
   if(!is_file_open(fd)){
-    lock_release(&syscall_lock);
     return;
   }
   file_seek(thread_current()->files[fd], position);
-  lock_release(&syscall_lock);
 }
 
 // DRIVER: TIMOTHY
 bool 
 create_helper(const char *file, unsigned initial_size){
   validate_pointer(file);
-  lock_acquire(&syscall_lock);
-
   bool success = filesys_create(file, initial_size);
-
-  lock_release(&syscall_lock);
   return success;
 }
 
 // DRIVER: BRUNO
 int
 filesize_helper(int fd){
-  lock_acquire(&syscall_lock);
   if(!is_file_open(fd)){
-    lock_release(&syscall_lock);
     return -1;
   }
   int result = file_length(thread_current()->files[fd]);
-  lock_release(&syscall_lock);
   return result;
 }
 
@@ -303,9 +346,7 @@ bool is_file_open(int fd){
 bool 
 remove_helper(const char *file){
   validate_pointer(file);
-  lock_acquire(&syscall_lock);
   bool success = filesys_remove(file);
-  lock_release(&syscall_lock);
   return success;
 }
 
@@ -313,17 +354,14 @@ remove_helper(const char *file){
 int
 open_helper(char *name){
   validate_pointer(name);
-  lock_acquire(&syscall_lock);
   struct thread *cur = thread_current();
   // can't open too many files
   if(cur->num_files_open >= MAX_FILES_OPEN){
-    lock_release(&syscall_lock);
     return -1;
   }
 
   struct file *f = filesys_open(name);
   if(f == NULL){
-    lock_release(&syscall_lock);
     return -1;
   }
 
@@ -338,7 +376,6 @@ open_helper(char *name){
   }
 
   cur->num_files_open++;
-  lock_release(&syscall_lock);
   return fd;
 }
 
@@ -389,13 +426,12 @@ int allocate_fd() {
 int
 write_helper(int fd, const void *buffer, unsigned size){
   validate_buffer(buffer, size);
-  lock_acquire(&syscall_lock);
   if(!is_file_open(fd) || fd == 0){
-    lock_release(&syscall_lock);
     return -1;
   }
   if(fd == 1){
     // write to stdout
+    int bytes = size;
     while (size >= 420)
     {
       putbuf(buffer, 420);
@@ -403,11 +439,9 @@ write_helper(int fd, const void *buffer, unsigned size){
       size -= 420;
     }
     putbuf(buffer, size);
-    lock_release(&syscall_lock);
-    return size;
+    return bytes;
   }
   int bytes_written = file_write(thread_current()->files[fd], buffer, size);
-  lock_release(&syscall_lock);
   return bytes_written;
 }
 
@@ -415,22 +449,204 @@ write_helper(int fd, const void *buffer, unsigned size){
 int
 read_helper(int fd, void *buffer, unsigned size){
   validate_buffer(buffer, size);
-  lock_acquire(&syscall_lock);
   if(!is_file_open(fd) || fd == 1){
-    lock_release(&syscall_lock);
     return -1;
   }
   if(fd == 0){
     char *buf = buffer;
-    while (size--)
-    {
-      *buf = input_getc();
-      buf++;
-    }
-    lock_release(&syscall_lock);
+    unsigned i;
+    for (i = 0; i < size; i++)
+      buf[i] = input_getc();
     return size;
   }
   int bytes_read = file_read(thread_current()->files[fd], buffer, size);
-  lock_release(&syscall_lock);
   return bytes_read;
 }
+
+// Returns the open regular file for fd, or NULL if fd is not one.  Unlike
+// is_file_open(), this rejects the console and the running executable.
+static struct file *
+regular_file(int fd) {
+  if (fd < 2 || !is_file_open(fd)) {
+    return NULL;
+  }
+  return thread_current()->files[fd];
+}
+
+// Reads size bytes from fd at offset without moving its file position.
+int
+pread_helper(int fd, void *buffer, unsigned size, unsigned offset) {
+  validate_buffer(buffer, size);
+  struct file *file = regular_file(fd);
+  if (file == NULL || (off_t) offset < 0) {
+    return -1;
+  }
+  return file_read_at(file, buffer, size, offset);
+}
+
+// Writes size bytes to fd at offset without moving its file position.
+int
+pwrite_helper(int fd, const void *buffer, unsigned size, unsigned offset) {
+  validate_buffer(buffer, size);
+  struct file *file = regular_file(fd);
+  if (file == NULL || (off_t) offset < 0) {
+    return -1;
+  }
+  return file_write_at(file, buffer, size, offset);
+}
+
+// Checks an iovec array from user space, killing the process if any of it
+// or the buffers it names are invalid.  Returns false if iovcnt is out of
+// range.
+static bool
+validate_iovec(const struct iovec *iov, int iovcnt) {
+  int i;
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return false;
+  }
+  validate_buffer(iov, iovcnt * sizeof *iov);
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > 0) {
+      validate_buffer(iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+  return true;
+}
+
+// Reads from fd into each buffer of iov in turn, as one read() would.
+// Stops early at end of file.
+int
+readv_helper(int fd, const struct iovec *iov, int iovcnt) {
+  int total = 0;
+  int i;
+  if (!validate_iovec(iov, iovcnt)) {
+    return -1;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0) {
+      continue;
+    }
+    int bytes = read_helper(fd, iov[i].iov_base, iov[i].iov_len);
+    if (bytes < 0) {
+      return i == 0 ? -1 : total;
+    }
+    total += bytes;
+    if ((size_t) bytes < iov[i].iov_len) {
+      break;
+    }
+  }
+  return total;
+}
+
+// Writes each buffer of iov to fd in turn, as one write() would.
+// Stops early if a write comes up short.
+int
+writev_helper(int fd, const struct iovec *iov, int iovcnt) {
+  int total = 0;
+  int i;
+  if (!validate_iovec(iov, iovcnt)) {
+    return -1;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0) {
+      continue;
+    }
+    int bytes = write_helper(fd, iov[i].iov_base, iov[i].iov_len);
+    if (bytes < 0) {
+      return i == 0 ? -1 : total;
+    }
+    total += bytes;
+    if ((size_t) bytes < iov[i].iov_len) {
+      break;
+    }
+  }
+  return total;
+}
+
+// Fills entries with as many of the next entries of directory fd as fit in
+// size bytes, picking up where the last readdir() or getdents() left off.
+// Returns the number of entries, 0 at the end of the directory, or -1 if fd
+// is not an open directory.
+int
+getdents_helper(int fd, struct dirent *entries, unsigned size) {
+  struct dir_record records[16];
+  size_t cnt = size / sizeof *entries;
+  size_t total = 0;
+  validate_buffer(entries, size);
+  if (fd < 0 || fd > 127 || !thread_current()->dirs[fd]) {
+    return -1;
+  }
+  while (total < cnt) {
+    size_t want = cnt - total < 16 ? cnt - total : 16;
+    size_t got = dir_readdir_many(thread_current()->dirs[fd], records, want);
+    size_t i;
+    for (i = 0; i < got; i++) {
+      entries[total + i].inumber = records[i].inode_sector;
+      entries[total + i].is_dir = records[i].is_dir;
+      strlcpy(entries[total + i].name, records[i].name,
+              sizeof entries[total + i].name);
+    }
+    total += got;
+    if (got < want) {
+      break;
+    }
+  }
+  return total;
+}
+
+// Writes the file or directory open as fd to disk, along with every other
+// change in the buffer cache, which doesn't track which file a sector belongs
+// to.  Returns false if fd is not open.
+bool
+fsync_helper(int fd) {
+  struct inode *inode;
+  if (fd < 3 || fd > 127) {
+    return false;
+  }
+  if (thread_current()->files[fd]) {
+    inode = file_get_inode(thread_current()->files[fd]);
+  } else if (thread_current()->dirs[fd]) {
+    inode = dir_get_inode(thread_current()->dirs[fd]);
+  } else {
+    return false;
+  }
+  inode_flush(inode);
+  cache_sync();
+  return true;
+}
+
+// Writes all buffered file system data to disk, including data still held
+// back by delayed allocation.
+void
+sync_helper(void) {
+  inode_flush_all();
+  cache_sync();
+}
+
+// Copies the block I/O statistics of the device in the given role into
+// stats.  Returns false if no device has that role.
+bool
+iostat_helper(int role, struct iostat *stats) {
+  struct block_stats s;
+  struct block *block;
+  int i;
+  validate_buffer(stats, sizeof *stats);
+  if (role < 0 || role >= BLOCK_ROLE_CNT) {
+    return false;
+  }
+  block = block_get_role(role);
+  if (block == NULL) {
+    return false;
+  }
+  block_get_stats(block, &s);
+  strlcpy(stats->device, block_name(block), sizeof stats->device);
+  stats->read_bytes = s.read_cnt * BLOCK_SECTOR_SIZE;
+  stats->write_bytes = s.write_cnt * BLOCK_SECTOR_SIZE;
+  stats->seq_cnt = s.seq_cnt;
+  stats->random_cnt = s.random_cnt;
+  stats->max_depth = s.max_depth;
+  for (i = 0; i < IOSTAT_BUCKETS; i++) {
+    stats->latency[i] = i < BLOCK_LATENCY_BUCKETS ? s.latency[i] : 0;
+  }
+  return true;
+}
@@ -3,6 +3,4 @@
 
 void syscall_init (void);
 
-static struct lock syscall_lock;
-
 #endif /* userprog/syscall.h */
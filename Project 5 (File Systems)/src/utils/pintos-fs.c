@@ -0,0 +1,2152 @@
+/* pintos-fs: builds, lists and checks Pintos file system images
+   on the host, at native speed, instead of booting Pintos and
+   extracting a tar archive from the scratch disk sector by
+   sector.
+
+   IMAGE is either a raw file system, as passed to
+   `pintos-mkdisk --filesys=FILE', or a partitioned Pintos disk,
+   in which case its file system partition is used.  The on-disk
+   format below must be kept in sync with filesys/inode.c,
+   filesys/directory.c, filesys/free-map.c and
+   filesys/journal.c.  Like Pintos itself, this assumes a
+   little-endian machine. */
+
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/* On-disk format. */
+
+#define SECTOR_SIZE 512
+typedef uint32_t sector_t;
+
+#define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
+#define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
+#define JOURNAL_SECTORS 128     /* Sectors reserved for the journal. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_SIZE (JOURNAL_SECTORS - 1)
+
+#define INODE_MAGIC 0x494e4f44  /* Inode mapping one sector per pointer. */
+#define EXTENT_MAGIC 0x494e4f45 /* Inode mapping extents. */
+#define JOURNAL_MAGIC 0x4a524e4c /* Journal header and log records. */
+
+#define NUM_DATA_BLOCKS 122
+#define PTRS_PER_BLOCK (SECTOR_SIZE / sizeof (sector_t))
+#define NUM_EXTENTS 61
+#define EXTENTS_PER_BLOCK 63
+#define INLINE_MAX 496
+
+/* Most data sectors a block-mapped inode can reach. */
+#define MAX_BLOCK_SECTORS (NUM_DATA_BLOCKS + PTRS_PER_BLOCK \
+                           + PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+
+#define PINTOS_NAME_MAX 14
+#define DIR_MIN_ENTRIES 16      /* Slots in a newly created directory. */
+
+#define PARTITION_FILESYS 0x21  /* MBR partition type of a file system. */
+
+struct extent
+  {
+    sector_t start;
+    uint32_t length;
+  };
+
+struct inode_disk
+  {
+    int32_t length;
+    sector_t parent_inode;
+    bool is_dir;
+    bool is_inline;
+    union
+      {
+        uint8_t inline_data[INLINE_MAX];
+        struct
+          {
+            sector_t data_blocks[NUM_DATA_BLOCKS];
+            sector_t primary_block;
+            sector_t secondary_block;
+          };
+        struct
+          {
+            uint32_t extent_cnt;
+            sector_t overflow_block;
+            struct extent extents[NUM_EXTENTS];
+          };
+      };
+    uint32_t magic;
+  };
+
+struct extent_block
+  {
+    sector_t next;
+    uint32_t unused;
+    struct extent extents[EXTENTS_PER_BLOCK];
+  };
+
+struct dir_entry
+  {
+    sector_t inode_sector;
+    char name[PINTOS_NAME_MAX + 1];
+    bool in_use;
+  };
+
+struct journal_header
+  {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t first_seq;
+    uint8_t unused[SECTOR_SIZE - 12];
+  };
+
+enum record_type
+  {
+    RECORD_DATA,
+    RECORD_REVOKE,
+    RECORD_COMMIT
+  };
+
+#define RECORD_MAX ((SECTOR_SIZE - 20) / sizeof (sector_t))
+
+struct journal_record
+  {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t seq;
+    uint32_t type;
+    uint32_t cnt;
+    sector_t sectors[RECORD_MAX];
+  };
+
+_Static_assert (sizeof (struct inode_disk) == SECTOR_SIZE, "inode_disk");
+_Static_assert (sizeof (struct extent_block) == SECTOR_SIZE, "extent_block");
+_Static_assert (sizeof (struct dir_entry) == 20, "dir_entry");
+_Static_assert (sizeof (struct journal_record) == SECTOR_SIZE, "record");
+
+/* Program state. */
+
+/* Sector number that names no sector. */
+#define NO_SECTOR ((sector_t) -1)
+
+/* Sectors moved with one read or write of the image. */
+#define CHUNK_SECTORS 2048
+
+static const char *image_name;  /* Image file name. */
+static int image_fd = -1;       /* Image file. */
+static off_t image_base;        /* Byte offset of the file system. */
+static sector_t fs_size;        /* Sectors in the file system. */
+static bool writable;           /* Opened for writing? */
+static bool use_extents;        /* Give new inodes the extent layout? */
+
+/* Free map, one bit per sector as Pintos's bitmap stores it. */
+static uint8_t *free_map;
+static size_t free_map_bytes;
+static size_t free_cnt;         /* Sectors clear in FREE_MAP. */
+static bool free_map_dirty;     /* Must FREE_MAP be written back? */
+static sector_t alloc_hint;     /* Where the next allocation looks first. */
+
+/* Metadata replayed from the journal of an image opened read-only,
+   consulted by read_sectors() in place of the image's contents. */
+struct replayed
+  {
+    sector_t sector;
+    uint8_t data[SECTOR_SIZE];
+  };
+static struct replayed *replayed;
+static size_t replayed_cnt;
+
+/* Scratch buffer for bulk transfers. */
+static uint8_t chunk[CHUNK_SECTORS * SECTOR_SIZE];
+
+/* Errors. */
+
+static void fail (const char *msg, ...)
+     __attribute__ ((noreturn))
+     __attribute__ ((format (printf, 1, 2)));
+static void fail_io (const char *msg, ...)
+     __attribute__ ((noreturn))
+     __attribute__ ((format (printf, 1, 2)));
+static void warn (const char *msg, ...)
+     __attribute__ ((format (printf, 1, 2)));
+
+/* Prints MSG, formatting as with printf(), and exits. */
+static void
+fail (const char *msg, ...)
+{
+  va_list args;
+
+  va_start (args, msg);
+  fprintf (stderr, "pintos-fs: ");
+  vfprintf (stderr, msg, args);
+  va_end (args);
+  putc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+/* Prints MSG, formatting as with printf(),
+   plus an error message based on errno,
+   and exits. */
+static void
+fail_io (const char *msg, ...)
+{
+  int error = errno;
+  va_list args;
+
+  va_start (args, msg);
+  fprintf (stderr, "pintos-fs: ");
+  vfprintf (stderr, msg, args);
+  va_end (args);
+  if (error != 0)
+    fprintf (stderr, ": %s", strerror (error));
+  putc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+/* Prints MSG, formatting as with printf(), and carries on. */
+static void
+warn (const char *msg, ...)
+{
+  va_list args;
+
+  va_start (args, msg);
+  fprintf (stderr, "pintos-fs: ");
+  vfprintf (stderr, msg, args);
+  va_end (args);
+  putc ('\n', stderr);
+}
+
+static void *
+xmalloc (size_t size)
+{
+  void *p = malloc (size != 0 ? size : 1);
+  if (p == NULL)
+    fail ("out of memory");
+  return p;
+}
+
+static void *
+xcalloc (size_t cnt, size_t size)
+{
+  void *p = calloc (cnt != 0 ? cnt : 1, size != 0 ? size : 1);
+  if (p == NULL)
+    fail ("out of memory");
+  return p;
+}
+
+static void *
+xrealloc (void *p, size_t size)
+{
+  p = realloc (p, size != 0 ? size : 1);
+  if (p == NULL)
+    fail ("out of memory");
+  return p;
+}
+
+/* Returns PATH with "/NAME" appended, in a new string. */
+static char *
+join_path (const char *path, const char *name)
+{
+  char *s = xmalloc (strlen (path) + strlen (name) + 2);
+  sprintf (s, "%s/%s", strcmp (path, "/") ? path : "", name);
+  return s;
+}
+
+static size_t
+div_round_up (uint64_t x, size_t step)
+{
+  return (x + step - 1) / step;
+}
+
+/* Lists of sectors. */
+
+/* A run of LENGTH disk sectors starting at START that hold file
+   sectors INDEX onward. */
+struct run
+  {
+    uint32_t index;
+    sector_t start;
+    uint32_t length;
+  };
+
+struct run_list
+  {
+    struct run *runs;
+    size_t cnt, cap;
+  };
+
+struct sector_list
+  {
+    sector_t *sectors;
+    size_t cnt, cap;
+  };
+
+/* Appends a run to LIST, extending the last run if the new one
+   continues it both within the file and on disk. */
+static void
+run_add (struct run_list *list, uint32_t index, sector_t start,
+         uint32_t length)
+{
+  if (list->cnt > 0)
+    {
+      struct run *last = &list->runs[list->cnt - 1];
+      if (last->index + last->length == index
+          && last->start + last->length == start)
+        {
+          last->length += length;
+          return;
+        }
+    }
+  if (list->cnt == list->cap)
+    {
+      list->cap = list->cap * 2 + 8;
+      list->runs = xrealloc (list->runs, list->cap * sizeof *list->runs);
+    }
+  list->runs[list->cnt].index = index;
+  list->runs[list->cnt].start = start;
+  list->runs[list->cnt].length = length;
+  list->cnt++;
+}
+
+static void
+sector_add (struct sector_list *list, sector_t sector)
+{
+  if (list->cnt == list->cap)
+    {
+      list->cap = list->cap * 2 + 8;
+      list->sectors = xrealloc (list->sectors,
+                                list->cap * sizeof *list->sectors);
+    }
+  list->sectors[list->cnt++] = sector;
+}
+
+/* Image access. */
+
+/* Reads or writes CNT sectors starting at SECTOR of the file
+   system through BUFFER. */
+static void
+transfer (bool write, sector_t sector, void *buffer, size_t cnt)
+{
+  uint8_t *p = buffer;
+  size_t size = cnt * SECTOR_SIZE;
+  off_t ofs = image_base + (off_t) sector * SECTOR_SIZE;
+
+  while (size > 0)
+    {
+      ssize_t n = (write
+                   ? pwrite (image_fd, p, size, ofs)
+                   : pread (image_fd, p, size, ofs));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        fail_io ("%s: %s sector %"PRIu32, image_name,
+                 write ? "writing" : "reading",
+                 (sector_t) ((ofs - image_base) / SECTOR_SIZE));
+      if (n == 0)
+        fail ("%s: unexpected end of image", image_name);
+      p += n;
+      ofs += n;
+      size -= n;
+    }
+}
+
+/* Panics unless CNT sectors starting at SECTOR lie within the
+   file system. */
+static void
+check_sectors (sector_t sector, size_t cnt)
+{
+  if (sector >= fs_size || cnt > fs_size - sector)
+    fail ("%s: sector %"PRIu32" is past the end of the file system",
+          image_name, sector >= fs_size ? sector : fs_size);
+}
+
+/* Reads CNT sectors starting at SECTOR into BUFFER, as they are
+   once the journal has been replayed. */
+static void
+read_sectors (sector_t sector, void *buffer, size_t cnt)
+{
+  size_t i;
+
+  check_sectors (sector, cnt);
+  transfer (false, sector, buffer, cnt);
+  for (i = 0; i < replayed_cnt; i++)
+    if (replayed[i].sector >= sector && replayed[i].sector - sector < cnt)
+      memcpy ((uint8_t *) buffer + (replayed[i].sector - sector) * SECTOR_SIZE,
+              replayed[i].data, SECTOR_SIZE);
+}
+
+static void
+write_sectors (sector_t sector, const void *buffer, size_t cnt)
+{
+  check_sectors (sector, cnt);
+  transfer (true, sector, (void *) buffer, cnt);
+}
+
+static void
+read_sector (sector_t sector, void *buffer)
+{
+  read_sectors (sector, buffer, 1);
+}
+
+static void
+write_sector (sector_t sector, const void *buffer)
+{
+  write_sectors (sector, buffer, 1);
+}
+
+/* Opens NAME and finds the file system in it.  If SIZE is
+   nonzero, NAME is created if needed and made a raw image of
+   SIZE sectors. */
+static void
+open_image (const char *name, bool write, sector_t size)
+{
+  uint8_t mbr[SECTOR_SIZE];
+  struct stat st;
+  ssize_t n;
+
+  image_name = name;
+  writable = write;
+  image_fd = open (name, (write ? O_RDWR : O_RDONLY) | (size ? O_CREAT : 0),
+                   0666);
+  if (image_fd < 0)
+    fail_io ("%s: open", name);
+
+  n = pread (image_fd, mbr, sizeof mbr, 0);
+  if (n < 0)
+    fail_io ("%s: read", name);
+  if (n == SECTOR_SIZE && mbr[510] == 0x55 && mbr[511] == 0xaa)
+    {
+      /* A partitioned disk, as made by pintos-mkdisk.  (The last
+         bytes of a free map inode hold its magic number, which
+         can't be mistaken for a partition table signature.) */
+      int i;
+
+      if (size != 0)
+        fail ("%s: can't resize a partitioned disk", name);
+      for (i = 0; i < 4; i++)
+        {
+          const uint8_t *e = mbr + 446 + 16 * i;
+          if (e[4] == PARTITION_FILESYS)
+            {
+              uint32_t start, cnt;
+              memcpy (&start, e + 8, sizeof start);
+              memcpy (&cnt, e + 12, sizeof cnt);
+              image_base = (off_t) start * SECTOR_SIZE;
+              fs_size = cnt;
+              break;
+            }
+        }
+      if (i == 4)
+        fail ("%s: disk has no file system partition", name);
+    }
+  else
+    {
+      if (size != 0 && ftruncate (image_fd, (off_t) size * SECTOR_SIZE) < 0)
+        fail_io ("%s: resizing to %"PRIu32" sectors", name, size);
+      if (fstat (image_fd, &st) < 0)
+        fail_io ("%s: stat", name);
+      image_base = 0;
+      fs_size = st.st_size / SECTOR_SIZE;
+    }
+
+  if (fs_size <= ROOT_DIR_SECTOR)
+    fail ("%s: file system is only %"PRIu32" sectors", name, fs_size);
+  free_map_bytes = div_round_up (fs_size, 32) * 4;
+}
+
+/* True if the file system is large enough to have a journal. */
+static bool
+has_journal (void)
+{
+  return fs_size > JOURNAL_SECTOR + JOURNAL_SECTORS;
+}
+
+/* Free map. */
+
+static bool
+bit_test (const uint8_t *map, sector_t sector)
+{
+  return (map[sector / 8] >> (sector % 8)) & 1;
+}
+
+static void
+bit_set (uint8_t *map, sector_t sector, bool value)
+{
+  if (value)
+    map[sector / 8] |= 1 << (sector % 8);
+  else
+    map[sector / 8] &= ~(1 << (sector % 8));
+}
+
+/* Marks CNT sectors starting at SECTOR in use. */
+static void
+mark_used (sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      if (bit_test (free_map, sector + i))
+        fail ("sector %"PRIu32" allocated twice", sector + (sector_t) i);
+      bit_set (free_map, sector + i, true);
+    }
+  free_cnt -= cnt;
+  free_map_dirty = true;
+}
+
+/* Marks CNT sectors starting at SECTOR free. */
+static void
+release (sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      if (!bit_test (free_map, sector + i))
+        fail ("sector %"PRIu32" freed twice", sector + (sector_t) i);
+      bit_set (free_map, sector + i, false);
+    }
+  free_cnt += cnt;
+  free_map_dirty = true;
+}
+
+/* Returns the first of CNT free sectors in a row between FROM
+   and TO, or NO_SECTOR. */
+static sector_t
+search (sector_t from, sector_t to, size_t cnt)
+{
+  size_t len = 0;
+  sector_t s;
+
+  for (s = from; s < to; s++)
+    if (s % 8 == 0 && s + 8 <= to && free_map[s / 8] == 0xff)
+      {
+        len = 0;
+        s += 7;
+      }
+    else if (bit_test (free_map, s))
+      len = 0;
+    else if (++len == cnt)
+      return s + 1 - cnt;
+  return NO_SECTOR;
+}
+
+/* Returns the first of CNT free sectors in a row at or after
+   GOAL, wrapping around to the start of the disk, or NO_SECTOR. */
+static sector_t
+find_run (size_t cnt, sector_t goal)
+{
+  sector_t start;
+
+  if (goal >= fs_size)
+    goal = 0;
+  start = search (goal, fs_size, cnt);
+  if (start == NO_SECTOR)
+    start = search (0, goal + cnt - 1 < fs_size ? goal + cnt - 1 : fs_size,
+                    cnt);
+  return start;
+}
+
+/* Allocates CNT sectors, in one run at or after GOAL if there is
+   one, otherwise in pieces taken first fit from GOAL onward, and
+   appends them to RUNS as file sectors INDEX onward.  Returns
+   false, allocating nothing, if fewer than CNT sectors are
+   free. */
+static bool
+allocate_runs (size_t cnt, sector_t goal, struct run_list *runs,
+               uint32_t index)
+{
+  sector_t start;
+
+  if (cnt > free_cnt)
+    return false;
+  start = find_run (cnt, goal);
+  if (start != NO_SECTOR)
+    {
+      mark_used (start, cnt);
+      run_add (runs, index, start, cnt);
+      alloc_hint = start + cnt;
+      return true;
+    }
+
+  while (cnt > 0)
+    {
+      size_t len = 0;
+
+      start = find_run (1, goal);
+      while (len < cnt && start + len < fs_size
+             && !bit_test (free_map, start + len))
+        len++;
+      mark_used (start, len);
+      run_add (runs, index, start, len);
+      index += len;
+      cnt -= len;
+      goal = start + len;
+    }
+  alloc_hint = goal;
+  return true;
+}
+
+/* Allocates CNT sectors near GOAL and stores them into SECTORS.
+   Returns false if the disk is full. */
+static bool
+allocate_sectors (size_t cnt, sector_t goal, sector_t sectors[])
+{
+  struct run_list runs = {NULL, 0, 0};
+  size_t i, j, k = 0;
+
+  if (!allocate_runs (cnt, goal, &runs, 0))
+    return false;
+  for (i = 0; i < runs.cnt; i++)
+    for (j = 0; j < runs.runs[i].length; j++)
+      sectors[k++] = runs.runs[i].start + j;
+  free (runs.runs);
+  return true;
+}
+
+/* Inodes. */
+
+static void
+read_inode (sector_t sector, struct inode_disk *d)
+{
+  read_sector (sector, d);
+}
+
+static void
+write_inode (sector_t sector, const struct inode_disk *d)
+{
+  write_sector (sector, d);
+}
+
+/* Initializes D as an empty inode in the file system's layout. */
+static void
+init_inode (struct inode_disk *d, bool is_dir)
+{
+  memset (d, 0, sizeof *d);
+  d->is_dir = is_dir;
+  d->magic = use_extents ? EXTENT_MAGIC : INODE_MAGIC;
+}
+
+/* Appends the data sectors of D to DATA in file order, leaving
+   out holes, and the index and overflow blocks that map them to
+   META, if it is non-null.  Index blocks past the end of the file
+   system are listed but not read.  Returns a description of the
+   problem if D's mapping is corrupt, otherwise a null pointer. */
+static const char *
+map_inode (const struct inode_disk *d, struct run_list *data,
+           struct sector_list *meta)
+{
+  sector_t block[PTRS_PER_BLOCK];
+  size_t i, j;
+
+  if (d->is_inline)
+    return d->length > INLINE_MAX ? "inline data too long" : NULL;
+
+  if (d->magic == INODE_MAGIC)
+    {
+      sector_t top[PTRS_PER_BLOCK];
+
+      for (i = 0; i < NUM_DATA_BLOCKS; i++)
+        if (d->data_blocks[i] != 0)
+          run_add (data, i, d->data_blocks[i], 1);
+      if (d->primary_block != 0)
+        {
+          if (meta != NULL)
+            sector_add (meta, d->primary_block);
+          if (d->primary_block >= fs_size)
+            return "primary index block out of range";
+          read_sector (d->primary_block, block);
+          for (j = 0; j < PTRS_PER_BLOCK; j++)
+            if (block[j] != 0)
+              run_add (data, NUM_DATA_BLOCKS + j, block[j], 1);
+        }
+      if (d->secondary_block != 0)
+        {
+          if (meta != NULL)
+            sector_add (meta, d->secondary_block);
+          if (d->secondary_block >= fs_size)
+            return "secondary index block out of range";
+          read_sector (d->secondary_block, top);
+          for (i = 0; i < PTRS_PER_BLOCK; i++)
+            if (top[i] != 0)
+              {
+                if (meta != NULL)
+                  sector_add (meta, top[i]);
+                if (top[i] >= fs_size)
+                  return "index block out of range";
+                read_sector (top[i], block);
+                for (j = 0; j < PTRS_PER_BLOCK; j++)
+                  if (block[j] != 0)
+                    run_add (data, NUM_DATA_BLOCKS + PTRS_PER_BLOCK
+                                   + i * PTRS_PER_BLOCK + j, block[j], 1);
+              }
+        }
+      return NULL;
+    }
+  else if (d->magic == EXTENT_MAGIC)
+    {
+      struct extent_block eb;
+      sector_t next = d->overflow_block;
+      uint32_t index = 0;
+
+      if (d->extent_cnt > fs_size)
+        return "bad extent count";
+      for (i = 0; i < d->extent_cnt; i++)
+        {
+          const struct extent *e;
+          if (i < NUM_EXTENTS)
+            e = &d->extents[i];
+          else
+            {
+              if ((i - NUM_EXTENTS) % EXTENTS_PER_BLOCK == 0)
+                {
+                  if (next == 0)
+                    return "overflow chain too short";
+                  if (meta != NULL)
+                    sector_add (meta, next);
+                  if (next >= fs_size)
+                    return "overflow block out of range";
+                  read_sector (next, &eb);
+                  next = eb.next;
+                }
+              e = &eb.extents[(i - NUM_EXTENTS) % EXTENTS_PER_BLOCK];
+            }
+          if (e->length > fs_size)
+            return "bad extent length";
+          run_add (data, index, e->start, e->length);
+          index += e->length;
+        }
+      return NULL;
+    }
+  else
+    return "bad magic number";
+}
+
+/* Passes the data of D, LENGTH bytes, to SINK in order, in
+   pieces, with holes reading as zeros. */
+static void
+copy_out (const struct inode_disk *d,
+          void (*sink) (const void *, size_t, void *), void *aux)
+{
+  static const uint8_t zeros[SECTOR_SIZE];
+  struct run_list runs = {NULL, 0, 0};
+  uint64_t pos = 0, length = d->length;
+  const char *error;
+  size_t i;
+
+  if (d->is_inline)
+    {
+      sink (d->inline_data, length, aux);
+      return;
+    }
+  error = map_inode (d, &runs, NULL);
+  if (error != NULL)
+    fail ("%s: %s", image_name, error);
+
+  for (i = 0; i <= runs.cnt && pos < length; i++)
+    {
+      uint64_t next = (i < runs.cnt
+                       ? (uint64_t) runs.runs[i].index * SECTOR_SIZE
+                       : length);
+      uint32_t done = 0;
+
+      if (next < pos)
+        continue;
+      for (; pos < next && pos < length; pos += SECTOR_SIZE)
+        sink (zeros, length - pos < SECTOR_SIZE ? length - pos : SECTOR_SIZE,
+              aux);
+      if (i == runs.cnt)
+        break;
+      pos = next;
+      while (done < runs.runs[i].length && pos < length)
+        {
+          size_t cnt = runs.runs[i].length - done;
+          size_t bytes;
+
+          if (cnt > CHUNK_SECTORS)
+            cnt = CHUNK_SECTORS;
+          read_sectors (runs.runs[i].start + done, chunk, cnt);
+          bytes = cnt * SECTOR_SIZE;
+          if (bytes > length - pos)
+            bytes = length - pos;
+          sink (chunk, bytes, aux);
+          pos += bytes;
+          done += cnt;
+        }
+    }
+  free (runs.runs);
+}
+
+struct buffer
+  {
+    uint8_t *data;
+    size_t size;
+  };
+
+static void
+buffer_sink (const void *data, size_t size, void *buffer_)
+{
+  struct buffer *buffer = buffer_;
+  memcpy (buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+/* Returns the data of D in a new buffer. */
+static uint8_t *
+read_all (const struct inode_disk *d)
+{
+  struct buffer buffer;
+
+  buffer.data = xmalloc (d->length);
+  buffer.size = 0;
+  copy_out (d, buffer_sink, &buffer);
+  return buffer.data;
+}
+
+/* Reads SIZE bytes from FD, named NAME, into BUFFER. */
+static void
+read_fully (int fd, const char *name, void *buffer, size_t size)
+{
+  uint8_t *p = buffer;
+
+  while (size > 0)
+    {
+      ssize_t n = read (fd, p, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        fail_io ("%s: read", name);
+      if (n == 0)
+        fail ("%s: file shrank while being read", name);
+      p += n;
+      size -= n;
+    }
+}
+
+/* Writes LENGTH bytes into the sectors of RUNS, from BUFFER if it
+   is non-null, otherwise from FD, named NAME.  The end of the
+   last sector is zeroed. */
+static void
+write_runs (const struct run_list *runs, int fd, const char *name,
+            const uint8_t *buffer, uint64_t length)
+{
+  uint64_t pos = 0;
+  size_t i;
+
+  for (i = 0; i < runs->cnt; i++)
+    {
+      uint32_t done = 0;
+
+      while (done < runs->runs[i].length)
+        {
+          size_t cnt = runs->runs[i].length - done;
+          size_t bytes;
+
+          if (cnt > CHUNK_SECTORS)
+            cnt = CHUNK_SECTORS;
+          bytes = cnt * SECTOR_SIZE;
+          if (bytes > length - pos)
+            bytes = length - pos;
+          if (buffer != NULL)
+            memcpy (chunk, buffer + pos, bytes);
+          else
+            read_fully (fd, name, chunk, bytes);
+          memset (chunk + bytes, 0, cnt * SECTOR_SIZE - bytes);
+          write_sectors (runs->runs[i].start + done, chunk, cnt);
+          pos += bytes;
+          done += cnt;
+        }
+    }
+}
+
+/* Maps the CNT data sectors of RUNS into block-mapped D,
+   allocating index blocks just past them.  Returns false if the
+   disk is full. */
+static bool
+set_blocks (struct inode_disk *d, const struct run_list *runs, size_t cnt)
+{
+  sector_t block[PTRS_PER_BLOCK];
+  sector_t *sectors = xmalloc (cnt * sizeof *sectors);
+  sector_t index_sectors[2 + PTRS_PER_BLOCK];
+  size_t index_cnt = 0, rest = 0, k = 0;
+  size_t i, j;
+
+  for (i = 0; i < runs->cnt; i++)
+    for (j = 0; j < runs->runs[i].length; j++)
+      sectors[k++] = runs->runs[i].start + j;
+
+  if (cnt > NUM_DATA_BLOCKS)
+    index_cnt++;
+  if (cnt > NUM_DATA_BLOCKS + PTRS_PER_BLOCK)
+    {
+      rest = cnt - NUM_DATA_BLOCKS - PTRS_PER_BLOCK;
+      index_cnt += 1 + div_round_up (rest, PTRS_PER_BLOCK);
+    }
+  if (index_cnt > 0 && !allocate_sectors (index_cnt, alloc_hint, index_sectors))
+    {
+      free (sectors);
+      return false;
+    }
+
+  k = 0;
+  for (i = 0; i < cnt && i < NUM_DATA_BLOCKS; i++)
+    d->data_blocks[i] = sectors[i];
+  if (cnt > NUM_DATA_BLOCKS)
+    {
+      memset (block, 0, sizeof block);
+      for (j = 0; j < PTRS_PER_BLOCK && NUM_DATA_BLOCKS + j < cnt; j++)
+        block[j] = sectors[NUM_DATA_BLOCKS + j];
+      d->primary_block = index_sectors[k++];
+      write_sector (d->primary_block, block);
+    }
+  if (rest > 0)
+    {
+      const sector_t *data = sectors + NUM_DATA_BLOCKS + PTRS_PER_BLOCK;
+      sector_t top[PTRS_PER_BLOCK];
+
+      memset (top, 0, sizeof top);
+      d->secondary_block = index_sectors[k++];
+      for (i = 0; i * PTRS_PER_BLOCK < rest; i++)
+        {
+          memset (block, 0, sizeof block);
+          for (j = 0; j < PTRS_PER_BLOCK && i * PTRS_PER_BLOCK + j < rest; j++)
+            block[j] = data[i * PTRS_PER_BLOCK + j];
+          top[i] = index_sectors[k++];
+          write_sector (top[i], block);
+        }
+      write_sector (d->secondary_block, top);
+    }
+  free (sectors);
+  return true;
+}
+
+/* Makes RUNS the extents of D, allocating overflow blocks just
+   past them if there are too many for the inode.  Returns false
+   if the disk is full. */
+static bool
+set_extents (struct inode_disk *d, const struct run_list *runs)
+{
+  size_t overflow_cnt = (runs->cnt > NUM_EXTENTS
+                         ? div_round_up (runs->cnt - NUM_EXTENTS,
+                                         EXTENTS_PER_BLOCK)
+                         : 0);
+  sector_t *overflow = xmalloc (overflow_cnt * sizeof *overflow);
+  size_t i;
+
+  if (overflow_cnt > 0 && !allocate_sectors (overflow_cnt, alloc_hint,
+                                             overflow))
+    {
+      free (overflow);
+      return false;
+    }
+
+  d->extent_cnt = runs->cnt;
+  d->overflow_block = overflow_cnt > 0 ? overflow[0] : 0;
+  for (i = 0; i < runs->cnt && i < NUM_EXTENTS; i++)
+    {
+      d->extents[i].start = runs->runs[i].start;
+      d->extents[i].length = runs->runs[i].length;
+    }
+  for (i = 0; i < overflow_cnt; i++)
+    {
+      struct extent_block eb;
+      size_t j;
+
+      memset (&eb, 0, sizeof eb);
+      eb.next = i + 1 < overflow_cnt ? overflow[i + 1] : 0;
+      for (j = 0; j < EXTENTS_PER_BLOCK; j++)
+        {
+          size_t idx = NUM_EXTENTS + i * EXTENTS_PER_BLOCK + j;
+          if (idx >= runs->cnt)
+            break;
+          eb.extents[j].start = runs->runs[idx].start;
+          eb.extents[j].length = runs->runs[idx].length;
+        }
+      write_sector (overflow[i], &eb);
+    }
+  free (overflow);
+  return true;
+}
+
+/* Gives D, an inode without data stored in INODE_SECTOR, LENGTH
+   bytes of data from BUFFER if it is non-null, otherwise from FD,
+   named NAME.  The data is kept inline if it fits, otherwise it
+   is written to sectors allocated in one run just past the inode
+   if possible.  The caller writes D afterward.  Returns a null
+   pointer if successful, otherwise the reason for failing. */
+static const char *
+store_data (struct inode_disk *d, sector_t inode_sector, int fd,
+            const char *name, const void *buffer, uint64_t length)
+{
+  struct run_list runs = {NULL, 0, 0};
+  size_t cnt = div_round_up (length, SECTOR_SIZE);
+  size_t i;
+
+  if (length > INT32_MAX)
+    return "too large for a Pintos file";
+  d->length = length;
+  if (length <= INLINE_MAX)
+    {
+      d->is_inline = true;
+      if (buffer != NULL)
+        memcpy (d->inline_data, buffer, length);
+      else
+        read_fully (fd, name, d->inline_data, length);
+      return NULL;
+    }
+
+  d->is_inline = false;
+  if (d->magic == INODE_MAGIC && cnt > MAX_BLOCK_SECTORS)
+    return "too large for block-mapped inodes (format with -e)";
+  if (!allocate_runs (cnt, inode_sector + 1, &runs, 0))
+    return "file system full";
+  if (d->magic == EXTENT_MAGIC ? !set_extents (d, &runs)
+                               : !set_blocks (d, &runs, cnt))
+    {
+      for (i = 0; i < runs.cnt; i++)
+        release (runs.runs[i].start, runs.runs[i].length);
+      free (runs.runs);
+      return "file system full";
+    }
+  write_runs (&runs, fd, name, buffer, length);
+  free (runs.runs);
+  return NULL;
+}
+
+/* Frees the data of D and its index or overflow blocks, leaving
+   D empty.  The caller writes D afterward. */
+static void
+release_data (struct inode_disk *d)
+{
+  struct run_list runs = {NULL, 0, 0};
+  struct sector_list meta = {NULL, 0, 0};
+  const char *error = map_inode (d, &runs, &meta);
+  size_t i;
+
+  if (error != NULL)
+    fail ("%s: %s", image_name, error);
+  for (i = 0; i < runs.cnt; i++)
+    release (runs.runs[i].start, runs.runs[i].length);
+  for (i = 0; i < meta.cnt; i++)
+    release (meta.sectors[i], 1);
+  free (runs.runs);
+  free (meta.sectors);
+  memset (d->inline_data, 0, sizeof d->inline_data);
+  d->is_inline = false;
+  d->length = 0;
+}
+
+/* Directories. */
+
+/* The entries of a directory, free slots included. */
+struct dir_buf
+  {
+    struct dir_entry *entries;
+    size_t cnt, cap;
+  };
+
+/* Reads the entries of directory D into DIR. */
+static void
+dir_load (const struct inode_disk *d, struct dir_buf *dir)
+{
+  dir->entries = (struct dir_entry *) read_all (d);
+  dir->cnt = dir->cap = d->length / sizeof *dir->entries;
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer. */
+static struct dir_entry *
+dir_find (struct dir_buf *dir, const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < dir->cnt; i++)
+    if (dir->entries[i].in_use
+        && !strncmp (dir->entries[i].name, name, PINTOS_NAME_MAX + 1))
+      return &dir->entries[i];
+  return NULL;
+}
+
+/* Adds NAME for the inode in SECTOR to DIR, in the first free
+   slot, as dir_add() does.  NAME must fit in a directory entry. */
+static void
+dir_append (struct dir_buf *dir, const char *name, sector_t sector)
+{
+  struct dir_entry *e = NULL;
+  size_t len = strlen (name);
+  size_t i;
+
+  if (len > PINTOS_NAME_MAX)
+    fail ("%s: name longer than %d characters", name, PINTOS_NAME_MAX);
+  for (i = 0; i < dir->cnt && e == NULL; i++)
+    if (!dir->entries[i].in_use)
+      e = &dir->entries[i];
+  if (e == NULL)
+    {
+      if (dir->cnt == dir->cap)
+        {
+          dir->cap = dir->cap * 2 + DIR_MIN_ENTRIES;
+          dir->entries = xrealloc (dir->entries,
+                                   dir->cap * sizeof *dir->entries);
+        }
+      e = &dir->entries[dir->cnt++];
+    }
+  memset (e, 0, sizeof *e);
+  e->inode_sector = sector;
+  memcpy (e->name, name, len);
+  e->name[len] = '\0';
+  e->in_use = true;
+}
+
+/* Stores DIR as the data of directory D, stored in SECTOR,
+   padded to at least as many slots as dir_create() gives a new
+   directory.  The caller writes D afterward. */
+static const char *
+dir_store (struct inode_disk *d, sector_t sector, struct dir_buf *dir)
+{
+  if (dir->cnt < DIR_MIN_ENTRIES)
+    {
+      dir->entries = xrealloc (dir->entries,
+                               DIR_MIN_ENTRIES * sizeof *dir->entries);
+      memset (dir->entries + dir->cnt, 0,
+              (DIR_MIN_ENTRIES - dir->cnt) * sizeof *dir->entries);
+      dir->cnt = dir->cap = DIR_MIN_ENTRIES;
+    }
+  return store_data (d, sector, -1, NULL, dir->entries,
+                     dir->cnt * sizeof *dir->entries);
+}
+
+/* Returns the inode sector of absolute PATH, or NO_SECTOR if it
+   does not exist. */
+static sector_t
+resolve (const char *path)
+{
+  char *copy = xmalloc (strlen (path) + 1);
+  char *name, *save_ptr;
+  sector_t sector = ROOT_DIR_SECTOR;
+
+  strcpy (copy, path);
+  for (name = strtok_r (copy, "/", &save_ptr); name != NULL;
+       name = strtok_r (NULL, "/", &save_ptr))
+    {
+      struct inode_disk d;
+      struct dir_buf dir;
+      struct dir_entry *e;
+
+      read_inode (sector, &d);
+      if (!d.is_dir)
+        {
+          sector = NO_SECTOR;
+          break;
+        }
+      if (!strcmp (name, "."))
+        continue;
+      if (!strcmp (name, ".."))
+        {
+          if (sector != ROOT_DIR_SECTOR)
+            sector = d.parent_inode;
+          continue;
+        }
+      dir_load (&d, &dir);
+      e = dir_find (&dir, name);
+      sector = e != NULL ? e->inode_sector : NO_SECTOR;
+      free (dir.entries);
+      if (sector == NO_SECTOR)
+        break;
+    }
+  free (copy);
+  return sector;
+}
+
+/* Mounting and formatting. */
+
+/* Replays the committed transactions in the journal, the way
+   filesys_init() does: into the image if it is writable,
+   otherwise into memory, where read_sectors() finds them. */
+static void
+replay_journal (void)
+{
+  struct journal_header h;
+  struct journal_record r;
+  struct revoke
+    {
+      sector_t sector;
+      uint32_t seq;
+    }
+  *revokes = NULL;
+  size_t revoke_cnt = 0, committed_revokes = 0;
+  uint32_t first_seq, seq, next_seq;
+  sector_t pos;
+  size_t i, j;
+
+  if (!has_journal ())
+    return;
+  read_sector (JOURNAL_SECTOR, &h);
+  if (h.magic != JOURNAL_MAGIC)
+    return;
+  first_seq = h.first_seq;
+
+#define READ_RECORD(POS, SEQ)                                           \
+  ((POS) < LOG_SIZE                                                     \
+   && (read_sector (LOG_START + (POS), &r), 1)                          \
+   && r.magic == JOURNAL_MAGIC && r.id == h.id && r.seq == (SEQ)        \
+   && r.cnt <= RECORD_MAX && (POS) + 1 + r.cnt <= LOG_SIZE)
+
+  /* Find the committed transactions and what they revoked. */
+  for (pos = 0, seq = first_seq; READ_RECORD (pos, seq); )
+    if (r.type == RECORD_COMMIT)
+      {
+        committed_revokes = revoke_cnt;
+        seq++;
+        pos++;
+      }
+    else if (r.type == RECORD_REVOKE)
+      {
+        revokes = xrealloc (revokes, (revoke_cnt + r.cnt) * sizeof *revokes);
+        for (i = 0; i < r.cnt; i++)
+          {
+            revokes[revoke_cnt].sector = r.sectors[i];
+            revokes[revoke_cnt++].seq = r.seq;
+          }
+        pos++;
+      }
+    else if (r.type == RECORD_DATA)
+      pos += 1 + r.cnt;
+    else
+      break;
+  if (seq == first_seq)
+    {
+      free (revokes);
+      return;
+    }
+
+  /* Apply them in order. */
+  for (pos = 0, next_seq = first_seq; next_seq < seq; )
+    {
+      if (!READ_RECORD (pos, next_seq))
+        fail ("%s: journal changed during replay", image_name);
+      if (r.type == RECORD_DATA)
+        for (i = 0; i < r.cnt; i++)
+          {
+            sector_t sector = r.sectors[i];
+            bool revoked = false;
+            struct replayed *p = NULL;
+
+            for (j = 0; j < committed_revokes; j++)
+              if (revokes[j].sector == sector && revokes[j].seq > next_seq)
+                revoked = true;
+            if (revoked || sector >= fs_size)
+              continue;
+            for (j = 0; j < replayed_cnt && p == NULL; j++)
+              if (replayed[j].sector == sector)
+                p = &replayed[j];
+            if (p == NULL)
+              {
+                replayed = xrealloc (replayed,
+                                     (replayed_cnt + 1) * sizeof *replayed);
+                p = &replayed[replayed_cnt++];
+                p->sector = sector;
+              }
+            read_sector (LOG_START + pos + 1 + i, p->data);
+          }
+      if (r.type == RECORD_COMMIT)
+        next_seq++;
+      pos += r.type == RECORD_DATA ? 1 + r.cnt : 1;
+    }
+#undef READ_RECORD
+  free (revokes);
+  warn ("%s: replayed %"PRIu32" journal transaction%s%s", image_name,
+        seq - first_seq, seq - first_seq != 1 ? "s" : "",
+        writable ? "" : " in memory");
+
+  /* Everything replayed is on disk, so start a new log. */
+  if (writable)
+    {
+      for (i = 0; i < replayed_cnt; i++)
+        write_sector (replayed[i].sector, replayed[i].data);
+      free (replayed);
+      replayed = NULL;
+      replayed_cnt = 0;
+      h.first_seq = next_seq;
+      write_sector (JOURNAL_SECTOR, &h);
+    }
+}
+
+/* Reads the file system's metadata, after replaying its
+   journal. */
+static void
+load_fs (void)
+{
+  struct inode_disk d;
+  sector_t s;
+
+  replay_journal ();
+
+  read_inode (ROOT_DIR_SECTOR, &d);
+  if ((d.magic != INODE_MAGIC && d.magic != EXTENT_MAGIC) || !d.is_dir)
+    fail ("%s: no Pintos file system (bad root directory)", image_name);
+  use_extents = d.magic == EXTENT_MAGIC;
+
+  read_inode (FREE_MAP_SECTOR, &d);
+  if (d.magic != INODE_MAGIC && d.magic != EXTENT_MAGIC)
+    fail ("%s: no Pintos file system (bad free map inode)", image_name);
+  if ((size_t) d.length != free_map_bytes)
+    fail ("%s: free map is %"PRId32" bytes, but %"PRIu32" sectors need %zu",
+          image_name, d.length, fs_size, free_map_bytes);
+  free_map = read_all (&d);
+  free_cnt = 0;
+  for (s = 0; s < fs_size; s++)
+    if (!bit_test (free_map, s))
+      free_cnt++;
+  alloc_hint = has_journal () ? JOURNAL_SECTOR + JOURNAL_SECTORS : 0;
+}
+
+/* Writes a new, empty file system, like `pintos -f' does. */
+static void
+format (bool extents)
+{
+  struct inode_disk d;
+  const char *error;
+
+  use_extents = extents;
+  free_map = xcalloc (1, free_map_bytes);
+  free_cnt = fs_size;
+  mark_used (FREE_MAP_SECTOR, 1);
+  mark_used (ROOT_DIR_SECTOR, 1);
+  if (has_journal ())
+    {
+      struct journal_header h;
+
+      /* A fresh ID keeps records left over from an earlier
+         format from being mistaken for ours. */
+      mark_used (JOURNAL_SECTOR, JOURNAL_SECTORS);
+      read_sector (JOURNAL_SECTOR, &h);
+      h.id = (h.magic == JOURNAL_MAGIC ? h.id + 1 : 1) ^ (uint32_t) time (NULL);
+      h.magic = JOURNAL_MAGIC;
+      h.first_seq = 1;
+      memset (h.unused, 0, sizeof h.unused);
+      write_sector (JOURNAL_SECTOR, &h);
+    }
+  alloc_hint = has_journal () ? JOURNAL_SECTOR + JOURNAL_SECTORS : 0;
+
+  /* The free map's contents are written for real when the image
+     is closed, once allocation is over. */
+  init_inode (&d, false);
+  error = store_data (&d, FREE_MAP_SECTOR, -1, NULL, free_map,
+                      free_map_bytes);
+  if (error != NULL)
+    fail ("%s: free map: %s", image_name, error);
+  write_inode (FREE_MAP_SECTOR, &d);
+
+  /* The root directory is its own parent. */
+  init_inode (&d, true);
+  d.parent_inode = ROOT_DIR_SECTOR;
+  d.is_inline = true;
+  d.length = DIR_MIN_ENTRIES * sizeof (struct dir_entry);
+  write_inode (ROOT_DIR_SECTOR, &d);
+}
+
+/* Writes the free map back if it changed, and closes the
+   image. */
+static void
+close_image (void)
+{
+  if (free_map_dirty && writable)
+    {
+      struct inode_disk d;
+      struct run_list runs = {NULL, 0, 0};
+      const char *error;
+
+      read_inode (FREE_MAP_SECTOR, &d);
+      if (d.is_inline)
+        {
+          memcpy (d.inline_data, free_map, free_map_bytes);
+          write_inode (FREE_MAP_SECTOR, &d);
+        }
+      else
+        {
+          size_t i, mapped = 0;
+
+          error = map_inode (&d, &runs, NULL);
+          if (error != NULL)
+            fail ("%s: free map: %s", image_name, error);
+          for (i = 0; i < runs.cnt; i++)
+            if (runs.runs[i].index != mapped)
+              fail ("%s: free map has a hole", image_name);
+            else
+              mapped += runs.runs[i].length;
+          if (mapped < div_round_up (free_map_bytes, SECTOR_SIZE))
+            fail ("%s: free map has a hole", image_name);
+          write_runs (&runs, -1, NULL, free_map, free_map_bytes);
+          free (runs.runs);
+        }
+      free_map_dirty = false;
+    }
+  if (image_fd >= 0 && close (image_fd) < 0)
+    fail_io ("%s: close", image_name);
+  image_fd = -1;
+}
+
+/* Importing. */
+
+/* Totals for the import summary. */
+static size_t import_files, import_dirs, import_runs;
+static uint64_t import_bytes;
+
+static void import_children (const char *host, sector_t sector,
+                             struct dir_buf *dir);
+
+/* Counts the data runs of D for the import summary. */
+static void
+count_runs (const struct inode_disk *d)
+{
+  struct run_list runs = {NULL, 0, 0};
+
+  if (!d->is_inline && map_inode (d, &runs, NULL) == NULL)
+    import_runs += runs.cnt;
+  free (runs.runs);
+}
+
+/* Imports host file PATH, SIZE bytes long, as a file in the
+   directory whose inode is in PARENT.  Returns the new inode's
+   sector, or NO_SECTOR on failure. */
+static sector_t
+import_file (const char *path, sector_t parent, off_t size)
+{
+  struct inode_disk d;
+  const char *error;
+  sector_t sector;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      warn ("%s: open: %s", path, strerror (errno));
+      return NO_SECTOR;
+    }
+  sector = find_run (1, alloc_hint);
+  if (sector == NO_SECTOR)
+    {
+      warn ("%s: file system full", path);
+      close (fd);
+      return NO_SECTOR;
+    }
+  mark_used (sector, 1);
+
+  init_inode (&d, false);
+  d.parent_inode = parent;
+  error = store_data (&d, sector, fd, path, NULL, size);
+  close (fd);
+  if (error != NULL)
+    {
+      warn ("%s: %s", path, error);
+      release (sector, 1);
+      return NO_SECTOR;
+    }
+  write_inode (sector, &d);
+  import_files++;
+  import_bytes += size;
+  count_runs (&d);
+  return sector;
+}
+
+/* Imports host directory PATH, and everything in it, as a
+   directory in the directory whose inode is in PARENT.  Returns
+   the new inode's sector, or NO_SECTOR on failure. */
+static sector_t
+import_dir (const char *path, sector_t parent)
+{
+  struct dir_buf dir = {NULL, 0, 0};
+  struct inode_disk d;
+  const char *error;
+  sector_t sector;
+
+  sector = find_run (1, alloc_hint);
+  if (sector == NO_SECTOR)
+    {
+      warn ("%s: file system full", path);
+      return NO_SECTOR;
+    }
+  mark_used (sector, 1);
+  alloc_hint = sector + 1;
+
+  /* Children go right after the directory's inode, and its
+     entries after them. */
+  import_children (path, sector, &dir);
+  init_inode (&d, true);
+  d.parent_inode = parent;
+  error = dir_store (&d, sector, &dir);
+  free (dir.entries);
+  if (error != NULL)
+    fail ("%s: %s", path, error);
+  write_inode (sector, &d);
+  import_dirs++;
+  count_runs (&d);
+  return sector;
+}
+
+/* Imports everything in host directory HOST, in name order, into
+   DIR, the entries of the directory whose inode is in SECTOR. */
+static void
+import_children (const char *host, sector_t sector, struct dir_buf *dir)
+{
+  struct dirent **names;
+  int cnt, i;
+
+  cnt = scandir (host, &names, NULL, alphasort);
+  if (cnt < 0)
+    {
+      warn ("%s: scandir: %s", host, strerror (errno));
+      return;
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      const char *name = names[i]->d_name;
+      char *path = join_path (host, name);
+      sector_t child = NO_SECTOR;
+      struct stat st;
+
+      if (!strcmp (name, ".") || !strcmp (name, ".."))
+        ;
+      else if (strlen (name) > PINTOS_NAME_MAX)
+        warn ("%s: name longer than %d characters, skipped", path, PINTOS_NAME_MAX);
+      else if (dir_find (dir, name) != NULL)
+        warn ("%s: already exists in image, skipped", path);
+      else if (lstat (path, &st) < 0)
+        warn ("%s: stat: %s", path, strerror (errno));
+      else if (S_ISDIR (st.st_mode))
+        child = import_dir (path, sector);
+      else if (S_ISREG (st.st_mode))
+        child = import_file (path, sector, st.st_size);
+      else
+        warn ("%s: not a regular file or directory, skipped", path);
+
+      if (child != NO_SECTOR)
+        dir_append (dir, name, child);
+      free (path);
+      free (names[i]);
+    }
+  free (names);
+}
+
+/* Imports everything in host directory HOST into directory
+   DEST in the image, which has been loaded or formatted. */
+static void
+import_tree (const char *host, const char *dest)
+{
+  struct dir_buf dir;
+  struct inode_disk d;
+  const char *error;
+  sector_t sector;
+  struct stat st;
+
+  if (stat (host, &st) < 0)
+    fail_io ("%s: stat", host);
+  if (!S_ISDIR (st.st_mode))
+    fail ("%s: not a directory", host);
+  sector = resolve (dest);
+  if (sector == NO_SECTOR)
+    fail ("%s: no such directory in image", dest);
+  read_inode (sector, &d);
+  if (!d.is_dir)
+    fail ("%s: not a directory in image", dest);
+
+  /* The destination's entries are rewritten, once, at the end. */
+  dir_load (&d, &dir);
+  import_children (host, sector, &dir);
+  release_data (&d);
+  error = dir_store (&d, sector, &dir);
+  if (error != NULL)
+    fail ("%s: %s", dest, error);
+  write_inode (sector, &d);
+  free (dir.entries);
+
+  printf ("%s: imported %zu files (%"PRIu64" bytes) and %zu directories "
+          "in %zu extents, %zu sectors free\n", image_name, import_files,
+          import_bytes, import_dirs, import_runs, free_cnt);
+}
+
+/* Commands. */
+
+/* Parses SIZE, a number of sectors or, with an `M' suffix, of
+   megabytes. */
+static sector_t
+parse_size (const char *size)
+{
+  char *end;
+  double n = strtod (size, &end);
+
+  if (!strcmp (end, "M") || !strcmp (end, "m"))
+    n *= 1024 * 1024 / SECTOR_SIZE;
+  else if (*end != '\0')
+    fail ("%s: bad size", size);
+  if (n < 1 || n > UINT32_MAX)
+    fail ("%s: bad size", size);
+  return n;
+}
+
+/* mkfs [-e] [-s SIZE] IMAGE [HOSTDIR] */
+static int
+cmd_mkfs (int argc, char *argv[])
+{
+  bool extents = false;
+  sector_t size = 0;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "es:")) != -1)
+    if (opt == 'e')
+      extents = true;
+    else if (opt == 's')
+      size = parse_size (optarg);
+    else
+      return -1;
+  if (argc - optind != 1 && argc - optind != 2)
+    return -1;
+
+  open_image (argv[optind], true, size);
+  format (extents);
+  printf ("%s: formatted %"PRIu32" sectors with %s inodes%s\n", image_name,
+          fs_size, extents ? "extent-based" : "block-mapped",
+          has_journal () ? " and a journal" : "");
+  if (argc - optind == 2)
+    import_tree (argv[optind + 1], "/");
+  close_image ();
+  return 0;
+}
+
+/* import IMAGE HOSTDIR [PATH] */
+static int
+cmd_import (int argc, char *argv[])
+{
+  if (argc - optind != 2 && argc - optind != 3)
+    return -1;
+  open_image (argv[optind], true, 0);
+  load_fs ();
+  import_tree (argv[optind + 1], argc - optind == 3 ? argv[optind + 2] : "/");
+  close_image ();
+  return 0;
+}
+
+/* Prints the entries of directory D, at PATH, and with RECURSIVE
+   those of its subdirectories.  VISITED marks directories already
+   printed, in case the image is corrupt. */
+static void
+list_dir (const struct inode_disk *d, const char *path, bool recursive,
+          uint8_t *visited)
+{
+  struct dir_buf dir;
+  size_t i;
+
+  dir_load (d, &dir);
+  if (recursive)
+    printf ("%s:\n", path);
+  for (i = 0; i < dir.cnt; i++)
+    if (dir.entries[i].in_use)
+      {
+        struct dir_entry *e = &dir.entries[i];
+        struct inode_disk child;
+
+        read_inode (e->inode_sector, &child);
+        printf ("%c %8"PRIu32" %10"PRId32" %.*s\n",
+                child.is_dir ? 'd' : '-', e->inode_sector, child.length,
+                PINTOS_NAME_MAX, e->name);
+      }
+  for (i = 0; recursive && i < dir.cnt; i++)
+    if (dir.entries[i].in_use)
+      {
+        struct dir_entry *e = &dir.entries[i];
+        struct inode_disk child;
+        char name[PINTOS_NAME_MAX + 1];
+        char *child_path;
+
+        read_inode (e->inode_sector, &child);
+        if (!child.is_dir || bit_test (visited, e->inode_sector))
+          continue;
+        bit_set (visited, e->inode_sector, true);
+        snprintf (name, sizeof name, "%.*s", PINTOS_NAME_MAX, e->name);
+        child_path = join_path (path, name);
+        printf ("\n");
+        list_dir (&child, child_path, true, visited);
+        free (child_path);
+      }
+  free (dir.entries);
+}
+
+/* ls [-R] IMAGE [PATH] */
+static int
+cmd_ls (int argc, char *argv[])
+{
+  bool recursive = false;
+  const char *path;
+  struct inode_disk d;
+  sector_t sector;
+  uint8_t *visited;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "R")) != -1)
+    if (opt == 'R')
+      recursive = true;
+    else
+      return -1;
+  if (argc - optind != 1 && argc - optind != 2)
+    return -1;
+  path = argc - optind == 2 ? argv[optind + 1] : "/";
+
+  open_image (argv[optind], false, 0);
+  load_fs ();
+  sector = resolve (path);
+  if (sector == NO_SECTOR)
+    fail ("%s: no such file or directory in image", path);
+  read_inode (sector, &d);
+  if (d.is_dir)
+    {
+      visited = xcalloc (1, free_map_bytes);
+      bit_set (visited, sector, true);
+      list_dir (&d, path, recursive, visited);
+      free (visited);
+    }
+  else
+    printf ("- %8"PRIu32" %10"PRId32" %s\n", sector, d.length, path);
+  close_image ();
+  return 0;
+}
+
+static void
+file_sink (const void *data, size_t size, void *file)
+{
+  if (fwrite (data, 1, size, file) != size)
+    fail_io ("write");
+}
+
+/* cat IMAGE PATH */
+static int
+cmd_cat (int argc, char *argv[])
+{
+  struct inode_disk d;
+  sector_t sector;
+
+  if (argc - optind != 2)
+    return -1;
+  open_image (argv[optind], false, 0);
+  load_fs ();
+  sector = resolve (argv[optind + 1]);
+  if (sector == NO_SECTOR)
+    fail ("%s: no such file in image", argv[optind + 1]);
+  read_inode (sector, &d);
+  if (d.is_dir)
+    fail ("%s: is a directory", argv[optind + 1]);
+  copy_out (&d, file_sink, stdout);
+  if (fflush (stdout) != 0)
+    fail_io ("write");
+  close_image ();
+  return 0;
+}
+
+/* State of a file system check. */
+static uint8_t *check_used;     /* Sectors found in use. */
+static unsigned check_errors, check_warnings;
+static size_t check_files, check_dirs;
+
+static void problem (bool error, const char *path, const char *msg, ...)
+     __attribute__ ((format (printf, 3, 4)));
+
+/* Reports a problem with PATH in the image. */
+static void
+problem (bool error, const char *path, const char *msg, ...)
+{
+  va_list args;
+
+  printf ("%s: %s: ", path, error ? "error" : "warning");
+  va_start (args, msg);
+  vprintf (msg, args);
+  va_end (args);
+  putchar ('\n');
+  if (error)
+    check_errors++;
+  else
+    check_warnings++;
+}
+
+/* Marks SECTOR in use.  Returns false if it is past the end of
+   the file system or already in use. */
+static bool
+claim (sector_t sector)
+{
+  if (sector >= fs_size || bit_test (check_used, sector))
+    return false;
+  bit_set (check_used, sector, true);
+  return true;
+}
+
+static void check_dir (const struct inode_disk *, sector_t, const char *);
+
+/* Checks the inode in SECTOR, at PATH, and everything under it.
+   PARENT is the directory it should name as its parent, or
+   NO_SECTOR if there is none to check. */
+static void
+check_inode (sector_t sector, sector_t parent, const char *path)
+{
+  struct run_list runs = {NULL, 0, 0};
+  struct sector_list meta = {NULL, 0, 0};
+  size_t bad_meta = 0, bad_data = 0, mapped = 0;
+  struct inode_disk d;
+  const char *error;
+  size_t i, j;
+
+  if (!claim (sector))
+    {
+      problem (true, path, "inode sector %"PRIu32" is %s", sector,
+               sector >= fs_size ? "out of range" : "used elsewhere");
+      return;
+    }
+  read_inode (sector, &d);
+  if (d.magic != INODE_MAGIC && d.magic != EXTENT_MAGIC)
+    {
+      problem (true, path, "bad inode magic %#"PRIx32, d.magic);
+      return;
+    }
+  if (d.length < 0)
+    {
+      problem (true, path, "negative length %"PRId32, d.length);
+      return;
+    }
+  if (parent != NO_SECTOR && d.parent_inode != parent)
+    problem (false, path, "parent is inode %"PRIu32", not %"PRIu32,
+             d.parent_inode, parent);
+
+  error = map_inode (&d, &runs, &meta);
+  if (error != NULL)
+    problem (true, path, "%s", error);
+  for (i = 0; i < meta.cnt; i++)
+    if (!claim (meta.sectors[i]))
+      bad_meta++;
+  for (i = 0; i < runs.cnt; i++)
+    {
+      for (j = 0; j < runs.runs[i].length; j++)
+        if (!claim (runs.runs[i].start + j))
+          bad_data++;
+      mapped += runs.runs[i].length;
+    }
+  if (bad_meta > 0)
+    problem (true, path, "%zu index sectors out of range or used elsewhere",
+             bad_meta);
+  if (bad_data > 0)
+    problem (true, path, "%zu data sectors out of range or used elsewhere",
+             bad_data);
+  if (error == NULL && !d.is_inline && d.magic == EXTENT_MAGIC
+      && mapped < div_round_up (d.length, SECTOR_SIZE))
+    problem (true, path, "extents map %zu of %zu sectors", mapped,
+             div_round_up (d.length, SECTOR_SIZE));
+
+  if (!d.is_dir)
+    check_files++;
+  else if (error != NULL || bad_meta > 0 || bad_data > 0)
+    problem (true, path, "directory not checked further");
+  else
+    check_dir (&d, sector, path);
+  free (runs.runs);
+  free (meta.sectors);
+}
+
+/* Checks the entries of directory D, stored in SECTOR, at PATH. */
+static void
+check_dir (const struct inode_disk *d, sector_t sector, const char *path)
+{
+  struct dir_buf dir;
+  size_t i, j;
+
+  check_dirs++;
+  if (d->length % sizeof (struct dir_entry) != 0)
+    problem (false, path, "length %"PRId32" is not a multiple of %zu",
+             d->length, sizeof (struct dir_entry));
+  dir_load (d, &dir);
+  for (i = 0; i < dir.cnt; i++)
+    {
+      struct dir_entry *e = &dir.entries[i];
+      bool duplicate = false;
+      char *child_path;
+
+      if (!e->in_use)
+        continue;
+      if (memchr (e->name, '\0', sizeof e->name) == NULL)
+        {
+          problem (true, path, "entry %zu: name not null-terminated", i);
+          continue;
+        }
+      if (e->name[0] == '\0' || strchr (e->name, '/') != NULL
+          || !strcmp (e->name, ".") || !strcmp (e->name, ".."))
+        {
+          problem (true, path, "entry %zu: bad name \"%s\"", i, e->name);
+          continue;
+        }
+      for (j = 0; j < i && !duplicate; j++)
+        duplicate = (dir.entries[j].in_use
+                     && !strncmp (dir.entries[j].name, e->name,
+                                  sizeof e->name));
+      if (duplicate)
+        {
+          problem (true, path, "entry %zu: duplicate name \"%s\"", i, e->name);
+          continue;
+        }
+      child_path = join_path (path, e->name);
+      check_inode (e->inode_sector, sector, child_path);
+      free (child_path);
+    }
+  free (dir.entries);
+}
+
+/* check [-f] IMAGE */
+static int
+cmd_check (int argc, char *argv[])
+{
+  bool fix = false;
+  size_t missing = 0, leaked = 0, used = 0;
+  struct inode_disk d;
+  sector_t s;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "f")) != -1)
+    if (opt == 'f')
+      fix = true;
+    else
+      return -1;
+  if (argc - optind != 1)
+    return -1;
+
+  open_image (argv[optind], fix, 0);
+  load_fs ();
+  check_used = xcalloc (1, free_map_bytes);
+  if (has_journal ())
+    for (s = JOURNAL_SECTOR; s < JOURNAL_SECTOR + JOURNAL_SECTORS; s++)
+      claim (s);
+
+  check_inode (FREE_MAP_SECTOR, NO_SECTOR, "(free map)");
+  read_inode (ROOT_DIR_SECTOR, &d);
+  check_inode (ROOT_DIR_SECTOR,
+               d.parent_inode == 0 ? NO_SECTOR : ROOT_DIR_SECTOR, "/");
+
+  for (s = 0; s < fs_size; s++)
+    if (bit_test (check_used, s))
+      {
+        used++;
+        if (!bit_test (free_map, s))
+          missing++;
+      }
+    else if (bit_test (free_map, s))
+      leaked++;
+  if (missing > 0 || leaked > 0)
+    {
+      if (fix)
+        {
+          memcpy (free_map, check_used, free_map_bytes);
+          free_map_dirty = true;
+        }
+      if (missing > 0)
+        problem (!fix, "(free map)", "%zu sectors in use are marked free%s",
+                 missing, fix ? ", fixed" : "");
+      if (leaked > 0)
+        problem (false, "(free map)",
+                 "%zu sectors marked in use are unreferenced%s",
+                 leaked, fix ? ", freed" : "");
+    }
+
+  printf ("%s: %zu files, %zu directories, %zu of %"PRIu32" sectors in use, "
+          "%u errors, %u warnings\n", image_name, check_files, check_dirs,
+          used, fs_size, check_errors, check_warnings);
+  close_image ();
+  free (check_used);
+  return check_errors > 0;
+}
+
+/* Fragmentation totals. */
+struct frag_stats
+  {
+    bool verbose;
+    size_t files, dirs, inline_cnt;
+    size_t mapped;              /* Inodes with data in sectors. */
+    size_t fragmented;          /* ...in more than one run. */
+    size_t runs;                /* Runs of all of those. */
+  };
+
+/* Adds the inode in SECTOR, at PATH, and everything under it to
+   STATS.  VISITED marks inodes already counted. */
+static void
+frag_walk (sector_t sector, const char *path, struct frag_stats *stats,
+           uint8_t *visited)
+{
+  struct run_list runs = {NULL, 0, 0};
+  struct inode_disk d;
+  const char *error;
+
+  if (sector >= fs_size || bit_test (visited, sector))
+    return;
+  bit_set (visited, sector, true);
+  read_inode (sector, &d);
+  if (d.is_dir)
+    stats->dirs++;
+  else
+    stats->files++;
+  if (d.is_inline)
+    stats->inline_cnt++;
+  else if ((error = map_inode (&d, &runs, NULL)) != NULL)
+    fail ("%s: %s (run check)", path, error);
+  else if (runs.cnt > 0)
+    {
+      stats->mapped++;
+      stats->runs += runs.cnt;
+      if (runs.cnt > 1)
+        {
+          stats->fragmented++;
+          if (stats->verbose)
+            printf ("%8zu %10"PRId32" %s\n", runs.cnt, d.length, path);
+        }
+    }
+  free (runs.runs);
+
+  if (d.is_dir)
+    {
+      struct dir_buf dir;
+      size_t i;
+
+      dir_load (&d, &dir);
+      for (i = 0; i < dir.cnt; i++)
+        if (dir.entries[i].in_use)
+          {
+            char name[PINTOS_NAME_MAX + 1];
+            char *child_path;
+
+            snprintf (name, sizeof name, "%.*s", PINTOS_NAME_MAX,
+                      dir.entries[i].name);
+            child_path = join_path (path, name);
+            frag_walk (dir.entries[i].inode_sector, child_path, stats,
+                       visited);
+            free (child_path);
+          }
+      free (dir.entries);
+    }
+}
+
+/* frag [-v] IMAGE */
+static int
+cmd_frag (int argc, char *argv[])
+{
+  struct frag_stats stats;
+  size_t free_runs = 0, largest = 0, len = 0;
+  uint8_t *visited;
+  sector_t s;
+  int opt;
+
+  memset (&stats, 0, sizeof stats);
+  while ((opt = getopt (argc, argv, "v")) != -1)
+    if (opt == 'v')
+      stats.verbose = true;
+    else
+      return -1;
+  if (argc - optind != 1)
+    return -1;
+
+  open_image (argv[optind], false, 0);
+  load_fs ();
+  visited = xcalloc (1, free_map_bytes);
+  if (stats.verbose)
+    printf ("    runs     length path\n");
+  frag_walk (ROOT_DIR_SECTOR, "/", &stats, visited);
+  free (visited);
+
+  for (s = 0; s <= fs_size; s++)
+    if (s < fs_size && !bit_test (free_map, s))
+      len++;
+    else if (len > 0)
+      {
+        free_runs++;
+        if (len > largest)
+          largest = len;
+        len = 0;
+      }
+
+  printf ("%zu files, %zu directories, %zu stored inline\n",
+          stats.files, stats.dirs, stats.inline_cnt);
+  printf ("%zu of %zu with data sectors are fragmented (%.1f%%), "
+          "%.2f runs each on average\n",
+          stats.fragmented, stats.mapped,
+          stats.mapped ? 100.0 * stats.fragmented / stats.mapped : 0.0,
+          stats.mapped ? (double) stats.runs / stats.mapped : 0.0);
+  printf ("%zu sectors free in %zu runs, largest %zu sectors\n",
+          free_cnt, free_runs, largest);
+  close_image ();
+  return 0;
+}
+
+struct command
+  {
+    const char *name;
+    int (*function) (int argc, char *argv[]);
+    const char *usage;
+  };
+
+static const struct command commands[] =
+  {
+    {"mkfs", cmd_mkfs, "mkfs [-e] [-s SIZE] IMAGE [HOSTDIR]\n"
+     "      Format IMAGE, then import HOSTDIR's contents, if given.\n"
+     "      -e gives inodes extents, as `pintos -f=extents' does.\n"
+     "      -s creates IMAGE as a raw file system of SIZE sectors,\n"
+     "      or megabytes with an `M' suffix.\n"},
+    {"import", cmd_import, "import IMAGE HOSTDIR [PATH]\n"
+     "      Copy HOSTDIR's contents into directory PATH (default /).\n"},
+    {"ls", cmd_ls, "ls [-R] IMAGE [PATH]\n"
+     "      List PATH (default /), and with -R its subdirectories.\n"},
+    {"cat", cmd_cat, "cat IMAGE PATH\n"
+     "      Copy file PATH to standard output.\n"},
+    {"check", cmd_check, "check [-f] IMAGE\n"
+     "      Check IMAGE for consistency; -f also repairs the free map.\n"},
+    {"frag", cmd_frag, "frag [-v] IMAGE\n"
+     "      Report fragmentation; -v lists fragmented files.\n"},
+  };
+#define COMMAND_CNT (sizeof commands / sizeof *commands)
+
+static void
+usage (void)
+{
+  size_t i;
+
+  fprintf (stderr,
+           "pintos-fs, builds and checks Pintos file system images\n"
+           "usage: pintos-fs COMMAND [OPTION...] IMAGE [ARG...]\n"
+           "where IMAGE is a raw file system or a partitioned Pintos disk\n"
+           "and COMMAND is one of:\n");
+  for (i = 0; i < COMMAND_CNT; i++)
+    fprintf (stderr, "  %s", commands[i].usage);
+  exit (EXIT_FAILURE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t i;
+
+  if (argc < 2)
+    usage ();
+  for (i = 0; i < COMMAND_CNT; i++)
+    if (!strcmp (argv[1], commands[i].name))
+      {
+        int result = commands[i].function (argc - 1, argv + 1);
+        if (result < 0)
+          {
+            fprintf (stderr, "usage: pintos-fs %s", commands[i].usage);
+            return EXIT_FAILURE;
+          }
+        return result > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+      }
+  usage ();
+}